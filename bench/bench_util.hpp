@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+/**
+ * @file bench_util.hpp
+ * @brief Timing helpers shared by the benchmarks, not part of the library.
+ */
+
+namespace mcan::bench {
+
+/// @brief Keep the compiler from optimizing the value or its computation away.
+template<typename T>
+inline void
+do_not_optimize(const T& value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/// @brief Run body(i) for i in [0, iterations) after a short warm up and print the
+/// average time of one iteration.
+/// @return nanoseconds per iteration.
+template<typename F>
+double
+measure_ns(const char* name, size_t iterations, F&& body)
+{
+  for (size_t i = 0; i < iterations / 10 + 1; ++i) {
+    body(i);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    body(i);
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  double ns = elapsed.count() / static_cast<double>(iterations);
+  std::printf("%-48s %10.2f ns\n", name, ns);
+  return ns;
+}
+
+} // namespace mcan::bench
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * InlineDelegate against std::function with the callback signature of the drivers:
+ * calling a stored callback, and copying one the way a callback table snapshot does,
+ * for a lambda capturing one pointer and one capturing three (bigger than the small
+ * buffer of std::function in libstdc++).
+ */
+
+#include "bench_util.hpp"
+#include "can_base.hpp"
+#include "inline_delegate.hpp"
+#include <cstdint>
+#include <functional>
+#include <string>
+
+using namespace mcan;
+using namespace mcan::bench;
+
+namespace {
+
+constexpr size_t k_iterations = 20000000;
+
+using Delegate = InlineDelegate<void(const CanFrame&, void*), 4 * sizeof(void*)>;
+using Function = std::function<void(const CanFrame&, void*)>;
+
+template<typename Callback, typename Lambda>
+void
+run(const std::string& name, Lambda lambda)
+{
+  Callback callback(lambda);
+  CanFrame frame{};
+  measure_ns((name + " call").c_str(), k_iterations, [&](size_t i) {
+    frame.id = static_cast<uint32_t>(i);
+    callback(frame, nullptr);
+  });
+  measure_ns((name + " copy").c_str(), k_iterations, [&](size_t) {
+    Callback copy(callback);
+    do_not_optimize(copy);
+  });
+}
+
+} // namespace
+
+int
+main()
+{
+  uint64_t sum = 0;
+  uint64_t count = 0;
+  uint64_t last = 0;
+  auto small = [&sum](const CanFrame& frame, void*) { sum += frame.id; };
+  auto large = [&sum, &count, &last](const CanFrame& frame, void*) {
+    sum += frame.id;
+    ++count;
+    last = frame.id;
+  };
+
+  run<Delegate>("InlineDelegate, 1 capture,", small);
+  run<Function>("std::function, 1 capture,", small);
+  run<Delegate>("InlineDelegate, 3 captures,", large);
+  run<Function>("std::function, 3 captures,", large);
+  do_not_optimize(sum + count + last);
+  return 0;
+}
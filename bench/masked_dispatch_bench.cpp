@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Lookup of masked callbacks: MaskedIdMatcher against the linear scan it replaced, with
+ * 1000 filters under one mask (a message on any node), spread over four masks and over
+ * 32 masks, where match() probes one table per mask, and the cost of adding and
+ * removing one filter next to them.
+ */
+
+#include "bench_util.hpp"
+#include "masked_id_matcher.hpp"
+#include <bit>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace mcan;
+using namespace mcan::bench;
+
+namespace {
+
+constexpr size_t k_filter_count = 1000;
+constexpr size_t k_lookups = 4096;
+constexpr size_t k_iterations = 4000000;
+
+struct Filter
+{
+  uint32_t id_base;
+  uint32_t id_mask;
+  int value;
+};
+
+/// @brief The previous lookup, the most specific of all matching filters.
+const int*
+linear_match(const std::vector<Filter>& filters, uint32_t id)
+{
+  const Filter* best = nullptr;
+  for (const Filter& filter : filters) {
+    if ((id & filter.id_mask) == filter.id_base &&
+        (best == nullptr ||
+         std::popcount(filter.id_mask) > std::popcount(best->id_mask))) {
+      best = &filter;
+    }
+  }
+  return best ? &best->value : nullptr;
+}
+
+void
+run(const char* name, const std::vector<uint32_t>& masks)
+{
+  MaskedIdMatcher<int> matcher;
+  std::vector<Filter> filters;
+  for (size_t i = 0; i < k_filter_count; ++i) {
+    uint32_t mask = masks[i % masks.size()];
+    uint32_t id_base = ((0x1000u + static_cast<uint32_t>(i)) << 8) & mask;
+    matcher.insert_or_assign(id_base, mask, static_cast<int>(i));
+    filters.push_back(Filter{ id_base, mask, static_cast<int>(i) });
+  }
+  // nine of ten lookups hit a filter, from any node
+  std::mt19937 generator(1);
+  std::vector<uint32_t> ids(k_lookups);
+  for (uint32_t& id : ids) {
+    uint32_t message = static_cast<uint32_t>(generator() % (k_filter_count * 10 / 9));
+    id = ((0x1000u + message) << 8) | (generator() & 0xFF);
+  }
+
+  std::printf("%s\n", name);
+  measure_ns("  MaskedIdMatcher::match()", k_iterations, [&](size_t i) {
+    do_not_optimize(matcher.match(ids[i % k_lookups]));
+  });
+  measure_ns("  linear scan", k_iterations / 100, [&](size_t i) {
+    do_not_optimize(linear_match(filters, ids[i % k_lookups]));
+  });
+  measure_ns("  insert_or_assign() and erase()", k_iterations / 10, [&](size_t i) {
+    uint32_t mask = masks[i % masks.size()];
+    uint32_t id_base = ((0x80000u + static_cast<uint32_t>(i % 4096)) << 8) & mask;
+    matcher.insert_or_assign(id_base, mask, 0);
+    do_not_optimize(matcher.erase(id_base, mask));
+  });
+}
+
+} // namespace
+
+int
+main()
+{
+  run("1000 filters, 1 mask", { 0x1FFFFF00 });
+  run("1000 filters, 4 masks", { 0x1FFFFF00, 0x1FFFFFFF, 0x1FFFF000, 0x1FFFFF0F });
+  std::vector<uint32_t> many_masks;
+  for (uint32_t i = 0; i < 32; ++i) {
+    // the node byte and every combination of the five bits above it ignored
+    many_masks.push_back(0x1FFFFF00u & ~(i << 8));
+  }
+  run("1000 filters, 32 masks", many_masks);
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Frames per second from one SocketCanBus to another over a virtual CAN interface,
+ * with one frame per syscall (io_batch_size = 1) and with recvmmsg/sendmmsg batches,
+ * and the CPU time the process (both buses, all threads) spends on them: CPU% of one
+ * core over the run and CPU nanoseconds per received frame.
+ *
+ * Set the interface up first:
+ *   ip link add dev vcan0 type vcan && ip link set up vcan0
+ * Usage: socket_can_throughput_bench [interface] [frames]
+ */
+
+#include "socket_can_bus.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <thread>
+
+using namespace mcan;
+
+namespace {
+
+constexpr uint32_t k_frame_id = 0x123;
+
+/// @brief CPU time used so far by all threads of the process.
+std::chrono::nanoseconds
+process_cpu_time()
+{
+  timespec time{};
+  (void)clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+}
+
+/// @return false if the interface can not be opened.
+bool
+run(const std::string& interface_name, size_t frames, size_t batch_size)
+{
+  SocketCanConfig config;
+  config.interface_name = interface_name;
+  config.io_batch_size = batch_size;
+  SocketCanBus receiver(config);
+  SocketCanBus sender(config);
+
+  std::atomic<size_t> received{ 0 };
+  (void)receiver.add_callback(
+    k_frame_id, [&received](CanBase&, const CanFrame&, void*) { ++received; });
+  Status status = receiver.open_can();
+  if (status.ok()) {
+    status = sender.open_can();
+  }
+  if (!status.ok()) {
+    std::printf("skipped, %s: %s\n", interface_name.c_str(), status.to_string().c_str());
+    return false;
+  }
+
+  CanFrame frame{};
+  frame.id = k_frame_id;
+  frame.size = 8;
+  auto start = std::chrono::steady_clock::now();
+  auto cpu_start = process_cpu_time();
+  for (size_t i = 0; i < frames; ++i) {
+    frame.data[0] = static_cast<uint8_t>(i);
+    while (sender.send(frame).status_code() == StatusCode::CapacityError) {
+      std::this_thread::yield();
+    }
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (received < frames && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::chrono::duration<double> cpu = process_cpu_time() - cpu_start;
+  const double delivered = static_cast<double>(received.load());
+  std::printf("io_batch_size %3zu: %zu/%zu frames, %.0f frames/s, CPU %.0f%%, "
+              "%.0f ns CPU/frame\n",
+              batch_size,
+              received.load(),
+              frames,
+              delivered / elapsed.count(),
+              100.0 * cpu.count() / elapsed.count(),
+              delivered > 0 ? 1e9 * cpu.count() / delivered : 0.0);
+  (void)sender.close_can();
+  (void)receiver.close_can();
+  return true;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  std::string interface_name = argc > 1 ? argv[1] : "vcan0";
+  size_t frames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+  for (size_t batch_size : { 1, 64 }) {
+    if (!run(interface_name, frames, batch_size)) {
+      break;
+    }
+  }
+  return 0;
+}
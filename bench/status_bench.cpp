@@ -0,0 +1,157 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Cost of the Status on the success path: creating, copying and checking an OK Status
+ * and an OK Result, then packing a 1000 byte message into a bus that only counts the
+ * frames, which returns one OK Status per frame. Error statuses are timed for
+ * comparison.
+ */
+
+#include "bench_util.hpp"
+#include "mc_common.hpp"
+#include <array>
+#include <cstdint>
+#include <string>
+
+using namespace mcan;
+using namespace mcan::bench;
+
+namespace {
+
+constexpr size_t k_iterations = 20000000;
+
+struct LargeMessage
+{
+  static constexpr uint32_t k_base_address = 0x100;
+  using Type = std::array<uint8_t, 1000>;
+  Type value;
+};
+
+/// @brief Bus that only counts the sent frames.
+class CountingCan : public CanBase
+{
+ public:
+  Status send(const CanFrame&) override
+  {
+    ++frames;
+    return Status::OK();
+  }
+
+  Result<CanFrame> send_await_response(const CanFrame&, uint32_t, uint32_t) override
+  {
+    return Status::TimeOut("No response received for the CAN frame"_status);
+  }
+
+  Status add_callback(uint32_t, can_callback_type, void*) override
+  {
+    return Status::OK();
+  }
+
+  Status add_callback_masked(uint32_t, uint32_t, can_callback_type, void*) override
+  {
+    return Status::OK();
+  }
+
+  Status remove_callback(uint32_t) override { return Status::OK(); }
+
+  Status remove_callback_masked(uint32_t, uint32_t) override { return Status::OK(); }
+
+  Status open_can() override { return Status::OK(); }
+
+  Status close_can() override { return Status::OK(); }
+
+  size_t frames = 0;
+};
+
+[[gnu::noinline]] Status
+check_value(size_t value)
+{
+  if (value == static_cast<size_t>(-1)) {
+    return Status::Invalid("Value out of range"_status);
+  }
+  return Status::OK();
+}
+
+[[gnu::noinline]] Result<size_t>
+parse_value(size_t value)
+{
+  ARI_RETURN_ON_ERROR(check_value(value));
+  return Result<size_t>::OK(std::move(value));
+}
+
+} // namespace
+
+int
+main()
+{
+  std::printf("sizeof(Status) %zu, sizeof(Result<CanFrame>) %zu\n",
+              sizeof(Status),
+              sizeof(Result<CanFrame>));
+
+  measure_ns("OK Status, create and check", k_iterations, [](size_t i) {
+    do_not_optimize(check_value(i).ok());
+  });
+  Status ok = Status::OK();
+  measure_ns("OK Status, copy", k_iterations, [&](size_t) {
+    Status copy(ok);
+    do_not_optimize(copy);
+  });
+  measure_ns("OK Result<size_t>, create and check", k_iterations, [](size_t i) {
+    do_not_optimize(parse_value(i).ok());
+  });
+
+  CountingCan can;
+  LargeMessage message{};
+  (void)mcan_pack_send_msg(can, message, 5);
+  size_t frames_per_send = can.frames;
+  double ns = measure_ns("mcan_pack_send_msg(), 1000 bytes", 20000, [&](size_t) {
+    do_not_optimize(mcan_pack_send_msg(can, message, 5).ok());
+  });
+  std::printf("%-48s %10.2f ns\n",
+              "  per frame",
+              ns / static_cast<double>(frames_per_send));
+
+  measure_ns("error Status, literal message", k_iterations, [](size_t) {
+    do_not_optimize(Status::Invalid("Value out of range"_status));
+  });
+  measure_ns("error Status, copy of a literal message", k_iterations, [](size_t) {
+    static const Status error = Status::Invalid("Value out of range"_status);
+    Status copy(error);
+    do_not_optimize(copy);
+  });
+  // formatted messages are interned, a few distinct texts repeat like real errors do
+  measure_ns("error Status, formatted message", k_iterations / 10, [](size_t i) {
+    do_not_optimize(Status::Invalid("Value " + std::to_string(i % 16) + " out of range"));
+  });
+  measure_ns("error Status, const char* message", k_iterations / 10, [](size_t) {
+    const char* message = "Value out of range";
+    do_not_optimize(message);
+    do_not_optimize(Status::Invalid(message));
+  });
+  return 0;
+}
@@ -26,42 +26,112 @@ SOFTWARE.
 
 #pragma once
 
+#include "inline_delegate.hpp"
 #include "status.hpp"
+#include <algorithm>
 #include <condition_variable>
 #include <functional>
+#include <future>
+#include <memory>
 
 namespace mcan {
 
 static constexpr uint32_t CAN_ANY_FRAME = 0;
 
-/// @brief CAN data frame.
+/// @brief Maximum data length of a classic CAN frame.
+static constexpr uint8_t CAN_MAX_DATA_LENGTH = 8;
+
+/// @brief Maximum data length of a CAN FD frame.
+static constexpr uint8_t CAN_FD_MAX_DATA_LENGTH = 64;
+
+/// @brief Data length coded by the 4 bit DLC field.
+/// @param dlc The DLC, only the lower 4 bits are used.
+/// @param is_fd Classic frames code at most 8 bytes, DLC 9-15 mean 8 bytes there.
+inline constexpr uint8_t
+can_dlc_to_length(uint8_t dlc, bool is_fd)
+{
+  constexpr uint8_t fd_lengths[16] = { 0, 1,  2,  3,  4,  5,  6,  7,
+                                       8, 12, 16, 20, 24, 32, 48, 64 };
+  dlc &= 0x0F;
+  if (!is_fd) {
+    return dlc > CAN_MAX_DATA_LENGTH ? CAN_MAX_DATA_LENGTH : dlc;
+  }
+  return fd_lengths[dlc];
+}
+
+/// @brief Smallest DLC which can hold the data length.
+/// @note CAN FD frames can only carry 0-8, 12, 16, 20, 24, 32, 48 or 64 bytes, other
+/// lengths are padded up to can_dlc_to_length(can_length_to_dlc(length, true), true).
+inline constexpr uint8_t
+can_length_to_dlc(uint8_t length, bool is_fd)
+{
+  if (length <= CAN_MAX_DATA_LENGTH || !is_fd) {
+    return length > CAN_MAX_DATA_LENGTH ? CAN_MAX_DATA_LENGTH : length;
+  }
+  uint8_t dlc = 9;
+  while (dlc < 15 && can_dlc_to_length(dlc, true) < length) {
+    ++dlc;
+  }
+  return dlc;
+}
+
+/// @brief CAN data frame, classic or CAN FD.
 struct CanFrame
 {
 
   /// @brief CAN ID of the frame. Either standard (11 bits) or extended (29 bits).
   uint32_t id;
 
-  /// @brief Length of the data in the frame. Maximum length is 64 bytes.
+  /// @brief Length of the data in the frame. Maximum length is 8 bytes for classic
+  /// frames and 64 bytes for CAN FD frames.
   uint8_t size;
 
   /// @brief Data of the frame. Maximum length is 64 bytes.
-  uint8_t data[8];
+  uint8_t data[CAN_FD_MAX_DATA_LENGTH];
 
   /// @brief Flag to indicate if the frame is a remote request.
   bool is_remote_request;
 
   /// @brief Flag to indicate if the frame is an extended frame.
   bool is_extended;
+
+  /// @brief Flag to indicate if the frame is a CAN FD frame.
+  bool is_fd = false;
+
+  /// @brief CAN FD bit rate switch, the data phase is sent with the data bit rate.
+  bool bit_rate_switch = false;
+
+  /// @brief CAN FD error state indicator, set by a transmitter that is error passive.
+  bool error_state_indicator = false;
 };
 
 class CanBase
 {
  public:
   using can_callback_type = std::function<void(CanBase&, const CanFrame&, void*)>;
+
+  /// @brief Allocation free alternative to can_callback_type, the callable is stored
+  /// inline and has to fit into the delegate (a std::function always fits).
+  using can_delegate_type =
+    InlineDelegate<void(CanBase&, const CanFrame&, void*),
+                   std::max(sizeof(can_callback_type), 4 * sizeof(void*))>;
+
+  /// @brief Completion handler of send_await_response_async(), called exactly once with
+  /// the response frame or the error (TimeOut, Cancelled when the bus is closed).
+  using response_handler_type =
+    InlineDelegate<void(Result<CanFrame>), 6 * sizeof(void*)>;
+
+  /// @brief Handler of send_await_response_stream_async(), called for every matching
+  /// frame until it returns false, or once with the error (TimeOut, Cancelled when the
+  /// bus is closed) after which the return value is ignored.
+  using response_stream_handler_type =
+    InlineDelegate<bool(Result<CanFrame>), 6 * sizeof(void*)>;
+
   virtual ~CanBase(){};
 
   /// @brief Send a CAN frame to the CAN bus.
-  /// @param frame The CAN frame to send.
+  /// @param frame The CAN frame to send. CAN FD frames are accepted only if
+  /// supports_fd() returns true, otherwise NotImplemented is returned.
   /// @note The frame will be sent to the CAN bus immediately if the driver is not
   /// threaded.
   /// @return Status of the operation.
@@ -77,6 +147,75 @@ class CanBase
                                                uint32_t response_id,
                                                uint32_t timeout_ms = 1000) = 0;
 
+  /// @brief Send can frame and get the response with specific CAN ID without blocking.
+  /// One thread can keep any number of requests in flight this way, e.g. poll every
+  /// node on the bus at once.
+  /// @param frame The CAN frame to send.
+  /// @param response_id The CAN ID of the expected response frame, CAN_ANY_FRAME
+  /// completes with the first received frame. Several requests for the same ID are
+  /// completed in the order they were made, one per received frame.
+  /// @param timeout_ms The timeout in milliseconds to wait for the response frame.
+  /// @param handler Called once with the response or the error, from the RX thread of
+  /// the driver. Not called if this function returns an error.
+  /// @note The default implementation blocks in send_await_response() and calls the
+  /// handler before returning, drivers with an RX thread override it.
+  /// @return Status of sending the request.
+  virtual Status send_await_response_async(const CanFrame& frame,
+                                           uint32_t response_id,
+                                           uint32_t timeout_ms,
+                                           response_handler_type handler)
+  {
+    if (!handler) {
+      return Status::Invalid("Response handler can not be empty"_status);
+    }
+    handler(send_await_response(frame, response_id, timeout_ms));
+    return Status::OK();
+  }
+
+  /// @brief Send can frame and get every response with specific CAN ID until the
+  /// handler has enough, e.g. all fragments of a multi frame message.
+  /// Works like send_await_response_async() except the request stays pending after a
+  /// matching frame, it takes every frame with the ID (before younger requests for the
+  /// same ID) until the handler returns false or the timeout passes.
+  /// @param timeout_ms The timeout of the whole stream in milliseconds.
+  /// @param handler Called from the RX thread of the driver, not called if this function
+  /// returns an error.
+  /// @note The default implementation returns NotImplemented, it needs a driver that
+  /// matches responses on its own.
+  /// @return Status of sending the request.
+  virtual Status send_await_response_stream_async(const CanFrame& frame,
+                                                  uint32_t response_id,
+                                                  uint32_t timeout_ms,
+                                                  response_stream_handler_type handler)
+  {
+    (void)frame;
+    (void)response_id;
+    (void)timeout_ms;
+    (void)handler;
+    return Status::NotImplemented(
+      "Response streams are not supported by the driver"_status);
+  }
+
+  /// @brief send_await_response_async() completing a future.
+  /// @return future with the response frame or the error.
+  std::future<Result<CanFrame>> send_await_response_future(const CanFrame& frame,
+                                                           uint32_t response_id,
+                                                           uint32_t timeout_ms = 1000)
+  {
+    auto promise = std::make_shared<std::promise<Result<CanFrame>>>();
+    std::future<Result<CanFrame>> future = promise->get_future();
+    Status status = send_await_response_async(
+      frame,
+      response_id,
+      timeout_ms,
+      response_handler_type(
+        [promise](Result<CanFrame> result) { promise->set_value(std::move(result)); }));
+    if (!status.ok()) {
+      promise->set_value(status);
+    }
+    return future;
+  }
+
   /// @brief Add a callback for a specific CAN ID.
   /// @param id The CAN ID to listen for, if you want to receive callback for a remote
   /// request you have to set by adding specific bit to ID
@@ -88,6 +227,21 @@ class CanBase
                               can_callback_type callback,
                               void* args = nullptr) = 0;
 
+  /// @brief Add a callback for a specific CAN ID stored in an inline delegate.
+  /// Same as the std::function overload, the delegate has to be constructed
+  /// explicitly: add_callback(id, can_delegate_type([&](...) { ... })).
+  /// @note The default implementation wraps the delegate into std::function, drivers
+  /// that store delegates natively override it.
+  virtual Status add_callback(uint32_t id,
+                              can_delegate_type callback,
+                              void* args = nullptr)
+  {
+    if (!callback) {
+      return Status::Invalid("Callback can not be empty"_status);
+    }
+    return add_callback(id, can_callback_type(std::move(callback)), args);
+  }
+
   /// @brief Add a callback for a specific CAN IDs with mask.
   /// so one callback can be used for multiple CAN IDs by using mask to specify which bits
   /// of the ID should be matched.
@@ -112,6 +266,19 @@ class CanBase
                                      can_callback_type callback,
                                      void* args = nullptr) = 0;
 
+  /// @brief Add a masked callback stored in an inline delegate, see add_callback().
+  virtual Status add_callback_masked(uint32_t id_base,
+                                     uint32_t id_mask,
+                                     can_delegate_type callback,
+                                     void* args = nullptr)
+  {
+    if (!callback) {
+      return Status::Invalid("Callback can not be empty"_status);
+    }
+    return add_callback_masked(
+      id_base, id_mask, can_callback_type(std::move(callback)), args);
+  }
+
   /// @brief Remove a callback for a specific CAN ID.
   /// @param id The CAN ID to remove the callback for.
   /// @return Status of the operation.
@@ -123,6 +290,10 @@ class CanBase
   /// @return Status of the operation.
   virtual Status remove_callback_masked(uint32_t id_base, uint32_t id_mask) = 0;
 
+  /// @brief Check if the driver can send and receive CAN FD frames.
+  /// @note Drivers may know this only after open_can().
+  virtual bool supports_fd() const { return false; }
+
   /// @brief Open the CAN socket.
   /// this should create two threads to handle CAN tx and rx with callbacks.
   /// @return Status of the operation.
@@ -0,0 +1,209 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace mcan {
+
+/// @brief Map from CAN ID to a value, laid out after the ID format from mc_common.hpp
+/// | 21 bits unique id | 8 bits node id |.
+/// The upper part of the ID (unique id plus the remote request flag) selects a page
+/// through a small open addressing table and the node id indexes the page directly, so
+/// a lookup is one hash probe (usually) and one array access. Values are kept in one
+/// flat array and pages only hold indices into it.
+/// find() never allocates, only insert_or_assign() does when a new unique id or more
+/// values have to be stored.
+/// @note Pages of removed unique ids are kept for reuse, so memory is bounded by the
+/// number of distinct unique ids ever registered. The map is not thread safe.
+template<typename Value>
+class CanIdMap
+{
+ public:
+  CanIdMap() { rehash(k_initial_buckets); }
+
+  /// @brief Find the value registered for the CAN ID.
+  /// @return pointer to the value or nullptr if there is none.
+  Value* find(uint32_t id)
+  {
+    uint16_t slot = _pages[find_page(id >> 8)][id & 0xFF];
+    return slot == k_empty ? nullptr : &_values[slot - 1].value;
+  }
+
+  const Value* find(uint32_t id) const { return const_cast<CanIdMap*>(this)->find(id); }
+
+  /// @brief Register a value for the CAN ID, replacing the previous one.
+  /// @return false if the map is full (65535 values).
+  bool insert_or_assign(uint32_t id, Value value)
+  {
+    uint32_t page = find_page(id >> 8);
+    if (page == k_null_page) {
+      page = add_page(id >> 8);
+    }
+    uint16_t& slot = _pages[page][id & 0xFF];
+    if (slot != k_empty) {
+      _values[slot - 1].value = std::move(value);
+      return true;
+    }
+    if (_free_values.empty() && _values.size() >= k_max_values) {
+      return false;
+    }
+    if (!_free_values.empty()) {
+      slot = _free_values.back();
+      _free_values.pop_back();
+      _values[slot - 1] = Entry{ std::move(value), id };
+    } else {
+      _values.push_back(Entry{ std::move(value), id });
+      slot = static_cast<uint16_t>(_values.size());
+    }
+    ++_size;
+    return true;
+  }
+
+  /// @brief Remove the value registered for the CAN ID.
+  /// @return false if there was none.
+  bool erase(uint32_t id)
+  {
+    uint16_t& slot = _pages[find_page(id >> 8)][id & 0xFF];
+    if (slot == k_empty) {
+      return false;
+    }
+    _values[slot - 1].value = Value{};
+    _free_values.push_back(slot);
+    slot = k_empty;
+    --_size;
+    return true;
+  }
+
+  /// @brief Call f(id, value) for every registered value.
+  template<typename F>
+  void for_each(F&& f) const
+  {
+    for (const auto& page : _pages) {
+      for (uint16_t slot : page) {
+        if (slot != k_empty) {
+          f(_values[slot - 1].id, _values[slot - 1].value);
+        }
+      }
+    }
+  }
+
+  size_t size() const { return _size; }
+
+  bool empty() const { return _size == 0; }
+
+ private:
+  using Page = std::array<uint16_t, 256>;
+
+  struct Entry
+  {
+    Value value;
+    uint32_t id;
+  };
+
+  struct Bucket
+  {
+    uint32_t key;
+    uint32_t page;
+  };
+
+  static constexpr uint16_t k_empty = 0;
+  static constexpr size_t k_max_values = 0xFFFF;
+  static constexpr size_t k_initial_buckets = 16;
+  // page 0 is always empty, lookups that miss the first level land there so find() does
+  // not need a separate branch for unknown unique ids
+  static constexpr uint32_t k_null_page = 0;
+
+  static uint32_t hash(uint32_t key, uint32_t shift)
+  {
+    // Fibonacci hashing, unique ids are often consecutive so a plain mask would cluster
+    return (key * 0x9E3779B1u) >> shift;
+  }
+
+  uint32_t find_page(uint32_t key) const
+  {
+    uint32_t mask = static_cast<uint32_t>(_buckets.size()) - 1;
+    for (uint32_t i = hash(key, _shift);; i = (i + 1) & mask) {
+      const Bucket& bucket = _buckets[i];
+      if (bucket.page == k_null_page || bucket.key == key) {
+        return bucket.page;
+      }
+    }
+  }
+
+  uint32_t add_page(uint32_t key)
+  {
+    if (_pages.size() * 2 >= _buckets.size()) {
+      rehash(_buckets.size() * 2);
+    }
+    _pages.push_back(Page{});
+    uint32_t page = static_cast<uint32_t>(_pages.size() - 1);
+    insert_bucket(key, page);
+    return page;
+  }
+
+  void insert_bucket(uint32_t key, uint32_t page)
+  {
+    uint32_t mask = static_cast<uint32_t>(_buckets.size()) - 1;
+    uint32_t i = hash(key, _shift);
+    while (_buckets[i].page != k_null_page) {
+      i = (i + 1) & mask;
+    }
+    _buckets[i] = Bucket{ key, page };
+  }
+
+  void rehash(size_t bucket_count)
+  {
+    std::vector<Bucket> old = std::move(_buckets);
+    _buckets.assign(bucket_count, Bucket{ 0, k_null_page });
+    _shift = 32;
+    for (size_t n = bucket_count; n > 1; n >>= 1) {
+      --_shift;
+    }
+    if (_pages.empty()) {
+      _pages.push_back(Page{});
+    }
+    for (const Bucket& bucket : old) {
+      if (bucket.page != k_null_page) {
+        insert_bucket(bucket.key, bucket.page);
+      }
+    }
+  }
+
+  std::vector<Bucket> _buckets;
+  uint32_t _shift = 32;
+  std::vector<Page> _pages;
+  std::vector<Entry> _values;
+  std::vector<uint16_t> _free_values;
+  size_t _size = 0;
+};
+
+} // namespace mcan
@@ -0,0 +1,217 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace mcan {
+
+template<typename Signature, size_t Capacity = 4 * sizeof(void*)>
+class InlineDelegate;
+
+namespace detail {
+
+/// @brief Callables that can be empty and are tested with operator!, like std::function
+/// does for its own constructor.
+template<typename F>
+struct is_nullable_callable
+  : std::bool_constant<std::is_pointer_v<F> || std::is_member_pointer_v<F>>
+{
+};
+
+template<typename Signature>
+struct is_nullable_callable<std::function<Signature>> : std::true_type
+{
+};
+
+template<typename Signature, size_t Capacity>
+struct is_nullable_callable<InlineDelegate<Signature, Capacity>> : std::true_type
+{
+};
+
+} // namespace detail
+
+/// @brief Type erased callable like std::function, but the callable is always stored
+/// inside the delegate, so constructing, copying and calling it never allocates.
+/// Callables bigger than Capacity are rejected at compile time. Trivially copyable
+/// callables (plain function pointers, lambdas capturing pointers and integers) are
+/// copied with memcpy and need no destructor call.
+/// A null function pointer, an empty std::function or an empty delegate of another
+/// capacity makes an empty delegate, like std::function does.
+/// @note The constructor from a callable is explicit, so passing a lambda to a function
+/// overloaded for std::function and InlineDelegate picks std::function unless the
+/// delegate is constructed explicitly.
+template<typename R, typename... Args, size_t Capacity>
+class InlineDelegate<R(Args...), Capacity>
+{
+ public:
+  static constexpr size_t capacity = Capacity;
+
+  InlineDelegate() = default;
+
+  template<typename F,
+           typename Fn = std::decay_t<F>,
+           typename = std::enable_if_t<!std::is_same_v<Fn, InlineDelegate> &&
+                                       std::is_invocable_r_v<R, Fn&, Args...>>>
+  explicit InlineDelegate(F&& f)
+  {
+    static_assert(sizeof(Fn) <= Capacity, "Callable does not fit into the delegate");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t),
+                  "Callable is over-aligned for the delegate");
+    static_assert(std::is_copy_constructible_v<Fn>, "Callable must be copyable");
+    static_assert(std::is_nothrow_move_constructible_v<Fn>,
+                  "Callable must be nothrow move constructible");
+    // a function passed by reference decays to a pointer but is never null
+    if constexpr (detail::is_nullable_callable<std::remove_cvref_t<F>>::value) {
+      if (!f) {
+        return;
+      }
+    }
+    ::new (static_cast<void*>(_storage)) Fn(std::forward<F>(f));
+    _invoke = &invoke<Fn>;
+    if constexpr (!std::is_trivially_copyable_v<Fn>) {
+      _manage = &manage<Fn>;
+    }
+  }
+
+  InlineDelegate(const InlineDelegate& other) { copy_from(other); }
+
+  InlineDelegate(InlineDelegate&& other) noexcept { move_from(other); }
+
+  InlineDelegate& operator=(const InlineDelegate& other)
+  {
+    if (this != &other) {
+      reset();
+      copy_from(other);
+    }
+    return *this;
+  }
+
+  InlineDelegate& operator=(InlineDelegate&& other) noexcept
+  {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  InlineDelegate& operator=(std::nullptr_t)
+  {
+    reset();
+    return *this;
+  }
+
+  ~InlineDelegate() { reset(); }
+
+  R operator()(Args... args) const
+  {
+    return _invoke(const_cast<unsigned char*>(_storage), std::forward<Args>(args)...);
+  }
+
+  explicit operator bool() const { return _invoke != nullptr; }
+
+ private:
+  enum class Operation
+  {
+    Copy,
+    Move,
+    Destroy
+  };
+
+  using invoke_type = R (*)(void*, Args&&...);
+  using manage_type = void (*)(Operation, void*, void*);
+
+  template<typename Fn>
+  static R invoke(void* storage, Args&&... args)
+  {
+    return std::invoke(*static_cast<Fn*>(storage), std::forward<Args>(args)...);
+  }
+
+  template<typename Fn>
+  static void manage(Operation operation, void* dst, void* src)
+  {
+    switch (operation) {
+      case Operation::Copy:
+        ::new (dst) Fn(*static_cast<const Fn*>(src));
+        break;
+      case Operation::Move:
+        ::new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+        static_cast<Fn*>(src)->~Fn();
+        break;
+      case Operation::Destroy:
+        static_cast<Fn*>(dst)->~Fn();
+        break;
+    }
+  }
+
+  void copy_from(const InlineDelegate& other)
+  {
+    if (other._manage) {
+      auto* source = const_cast<unsigned char*>(other._storage);
+      other._manage(Operation::Copy, _storage, source);
+    } else if (other._invoke) {
+      std::memcpy(_storage, other._storage, Capacity);
+    }
+    _invoke = other._invoke;
+    _manage = other._manage;
+  }
+
+  void move_from(InlineDelegate& other)
+  {
+    if (other._manage) {
+      other._manage(Operation::Move, _storage, other._storage);
+    } else if (other._invoke) {
+      std::memcpy(_storage, other._storage, Capacity);
+    }
+    _invoke = other._invoke;
+    _manage = other._manage;
+    other._invoke = nullptr;
+    other._manage = nullptr;
+  }
+
+  void reset()
+  {
+    if (_manage) {
+      _manage(Operation::Destroy, _storage, nullptr);
+    }
+    _invoke = nullptr;
+    _manage = nullptr;
+  }
+
+  alignas(std::max_align_t) unsigned char _storage[Capacity];
+  invoke_type _invoke = nullptr;
+  // nullptr for trivially copyable callables
+  manage_type _manage = nullptr;
+};
+
+} // namespace mcan
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include "status.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mcan {
+
+class SocketCanBus;
+
+/// @brief Configuration of the io_uring completion loop.
+struct IoUringLoopConfig
+{
+  /// @brief Number of submission queue entries, the completion queue is eight times as
+  /// big so multishot receives of many buses do not overflow it.
+  unsigned queue_depth = 256;
+
+  /// @brief Number of receive buffers in the provided buffer ring of every bus, must be
+  /// a power of two.
+  unsigned rx_buffers_per_bus = 256;
+
+  /// @brief Maximum number of frames sent in one chain of linked SQEs.
+  unsigned tx_chain_length = 32;
+};
+
+/// @brief Single thread io_uring completion loop serving any number of SocketCanBus
+/// instances.
+/// RX uses one multishot receive per bus with a provided buffer ring, so the kernel
+/// keeps filling buffers without a new submission per frame. TX frames queued by
+/// SocketCanBus::send() are submitted by the loop as chains of linked SQEs, which keeps
+/// them in order while send() itself only enqueues. Callbacks of every attached bus are
+/// called from the loop thread.
+/// Pass the loop to SocketCanConfig::io_uring_loop to use it, a bus falls back to its
+/// own epoll threads if it can not be attached.
+class IoUringLoop
+{
+ public:
+  /// @brief Create the loop and start its thread.
+  /// @return Invalid if the config is out of range, NotImplemented if io_uring,
+  /// multishot receive or provided buffer rings are not supported by the running kernel,
+  /// OutOfMemory if the rings can not be mapped and IOError if the probe socket pair or
+  /// the wake up eventfd can not be created.
+  static Result<std::shared_ptr<IoUringLoop>> create(IoUringLoopConfig config = {});
+
+  ~IoUringLoop();
+
+  IoUringLoop(const IoUringLoop&) = delete;
+  IoUringLoop& operator=(const IoUringLoop&) = delete;
+
+ private:
+  friend class SocketCanBus;
+  struct Ring;
+  struct Channel;
+  struct Command;
+
+  explicit IoUringLoop(IoUringLoopConfig config);
+
+  /// @brief Start serving the bus socket, blocks until the loop armed the receive.
+  Status attach(SocketCanBus& bus, int fd);
+
+  /// @brief Stop serving the bus, blocks until all operations of the bus completed.
+  void detach(SocketCanBus& bus);
+
+  /// @brief Wake up the loop so it picks up frames queued by SocketCanBus::send().
+  void wake();
+
+  /// @brief True on the loop thread, where callbacks of every attached bus run.
+  bool runs_on_loop_thread() const
+  {
+    return std::this_thread::get_id() == _thread.get_id();
+  }
+
+  Status start();
+  void run();
+  void process_commands();
+  /// @brief Arm what is not armed, e.g. a multishot operation the kernel terminated or
+  /// an operation that found the SQ full, called once per loop iteration.
+  void arm_pending();
+  void arm_cancel(Channel& channel);
+  void arm_wake();
+  void arm_receive(Channel& channel);
+  void arm_request_timer(Channel& channel);
+  void arm_retry_timer();
+  void flush_tx(Channel& channel);
+  void handle_completion(uint64_t user_data, int32_t res, uint32_t flags);
+  void try_finish_detach(Channel& channel);
+
+  IoUringLoopConfig _config;
+  std::unique_ptr<Ring> _ring;
+  int _wake_fd = -1;
+  std::atomic<bool> _stopping{ false };
+  bool _wake_armed = false;
+  bool _retry_timer_armed = false;
+  std::thread _thread;
+
+  std::mutex _commands_mutex;
+  std::vector<Command*> _commands;
+
+  // indexed by channel id, which is also the buffer group id of the channel
+  std::vector<std::unique_ptr<Channel>> _channels;
+};
+
+} // namespace mcan
@@ -0,0 +1,254 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace mcan {
+
+/// @brief Matcher for (id_base, id_mask) filters with deterministic priority: the
+/// filter with the most bits set in the mask wins, filters with equally specific masks
+/// are ordered by the time their mask was first registered.
+/// The filters are kept in one hash table per distinct mask, ordered by specificity, so
+/// match() costs one hash probe per distinct mask no matter how many filters share it.
+/// In practice there are only a few distinct masks (whole message, message on any
+/// node, ...), so the lookup is effectively constant for thousands of filters. The
+/// number of distinct masks is not bounded though, match() grows linearly with it,
+/// about 2 ns per mask (see bench/masked_dispatch_bench.cpp). match() never allocates.
+/// Adding or removing a filter only updates the table of its mask, at an amortized
+/// constant cost.
+/// @note The matcher is not thread safe.
+template<typename Value>
+class MaskedIdMatcher
+{
+ public:
+  /// @brief Add a filter or replace the value of an existing one.
+  void insert_or_assign(uint32_t id_base, uint32_t id_mask, Value value)
+  {
+    id_base &= id_mask;
+    Group* group = find_group(id_mask);
+    if (group == nullptr) {
+      group = add_group(id_mask);
+    }
+    if (Slot* slot = group->find(id_base)) {
+      group->entries[slot->entry - 1].value = std::move(value);
+      return;
+    }
+    group->entries.push_back(Entry{ id_base, std::move(value) });
+    if (group->entries.size() * 4 > group->slots.size()) {
+      group->rehash();
+    } else {
+      group->place(id_base, static_cast<uint32_t>(group->entries.size()));
+    }
+    ++_size;
+  }
+
+  /// @brief Remove a filter.
+  /// @return false if there was no such filter.
+  bool erase(uint32_t id_base, uint32_t id_mask)
+  {
+    id_base &= id_mask;
+    Group* group = find_group(id_mask);
+    Slot* slot = group != nullptr ? group->find(id_base) : nullptr;
+    if (slot == nullptr) {
+      return false;
+    }
+    group->erase(slot);
+    --_size;
+    if (group->entries.empty()) {
+      // a mask that is no longer used is forgotten, registered again later it is
+      // ordered as a new one
+      _groups.erase(_groups.begin() + (group - _groups.data()));
+    }
+    return true;
+  }
+
+  /// @brief Find the most specific filter matching the ID.
+  /// @return pointer to the value of the filter or nullptr if no filter matches.
+  const Value* match(uint32_t id) const
+  {
+    for (const Group& group : _groups) {
+      uint32_t key = id & group.mask;
+      const Slot* slots = group.slots.data();
+      for (uint32_t i = hash(key, group.shift);; i = (i + 1) & group.slot_mask) {
+        if (slots[i].entry == k_empty) {
+          break;
+        }
+        if (slots[i].key == key) {
+          return &group.entries[slots[i].entry - 1].value;
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  Value* match(uint32_t id)
+  {
+    return const_cast<Value*>(std::as_const(*this).match(id));
+  }
+
+  /// @brief Call f(id_base, id_mask, value) for every filter.
+  template<typename F>
+  void for_each(F&& f) const
+  {
+    for (const Group& group : _groups) {
+      for (const Entry& entry : group.entries) {
+        f(entry.id_base, group.mask, entry.value);
+      }
+    }
+  }
+
+  size_t size() const { return _size; }
+
+  bool empty() const { return _size == 0; }
+
+ private:
+  struct Entry
+  {
+    uint32_t id_base;
+    Value value;
+  };
+
+  struct Slot
+  {
+    uint32_t key;
+    // index of the entry plus one, k_empty for a free slot
+    uint32_t entry;
+  };
+
+  static constexpr uint32_t k_empty = 0;
+
+  static uint32_t hash(uint32_t key, uint32_t shift)
+  {
+    return (key * 0x9E3779B1u) >> shift;
+  }
+
+  /// @brief The filters of one mask, in a linear probing table that is kept at most a
+  /// quarter full: a lookup probes every mask more specific than the one it matches and
+  /// misses there, at half load the miss chains dominated match().
+  struct Group
+  {
+    uint32_t mask = 0;
+    uint32_t slot_mask = 1;
+    uint32_t shift = 31;
+    std::vector<Entry> entries;
+    std::vector<Slot> slots = std::vector<Slot>(2, Slot{ 0, k_empty });
+
+    Slot* find(uint32_t key)
+    {
+      for (uint32_t i = hash(key, shift);; i = (i + 1) & slot_mask) {
+        if (slots[i].entry == k_empty) {
+          return nullptr;
+        }
+        if (slots[i].key == key) {
+          return &slots[i];
+        }
+      }
+    }
+
+    void place(uint32_t key, uint32_t entry)
+    {
+      uint32_t i = hash(key, shift);
+      while (slots[i].entry != k_empty) {
+        i = (i + 1) & slot_mask;
+      }
+      slots[i] = Slot{ key, entry };
+    }
+
+    /// @brief Rebuild the table with room for the entries.
+    void rehash()
+    {
+      uint32_t slot_count = 2;
+      shift = 31;
+      while (slot_count < entries.size() * 4) {
+        slot_count <<= 1;
+        --shift;
+      }
+      slot_mask = slot_count - 1;
+      slots.assign(slot_count, Slot{ 0, k_empty });
+      for (size_t e = 0; e < entries.size(); ++e) {
+        place(entries[e].id_base, static_cast<uint32_t>(e + 1));
+      }
+    }
+
+    /// @brief Remove the entry of the slot, the last entry takes its place.
+    void erase(Slot* slot)
+    {
+      uint32_t removed = slot->entry;
+      uint32_t last = static_cast<uint32_t>(entries.size());
+      if (removed != last) {
+        find(entries[last - 1].id_base)->entry = removed;
+        entries[removed - 1] = std::move(entries[last - 1]);
+      }
+      entries.pop_back();
+      // backward shift deletion: move later entries of the probe chain into the hole,
+      // unless that would put them before their home slot
+      uint32_t hole = static_cast<uint32_t>(slot - slots.data());
+      for (uint32_t i = (hole + 1) & slot_mask; slots[i].entry != k_empty;
+           i = (i + 1) & slot_mask) {
+        uint32_t home = hash(slots[i].key, shift);
+        if (((i - home) & slot_mask) >= ((i - hole) & slot_mask)) {
+          slots[hole] = slots[i];
+          hole = i;
+        }
+      }
+      slots[hole] = Slot{ 0, k_empty };
+    }
+  };
+
+  Group* find_group(uint32_t mask)
+  {
+    for (Group& group : _groups) {
+      if (group.mask == mask) {
+        return &group;
+      }
+    }
+    return nullptr;
+  }
+
+  /// @brief Add an empty group for a new mask, after all groups at least as specific.
+  Group* add_group(uint32_t mask)
+  {
+    auto position = std::find_if(_groups.begin(), _groups.end(), [mask](const Group& g) {
+      return std::popcount(g.mask) < std::popcount(mask);
+    });
+    Group group;
+    group.mask = mask;
+    return &*_groups.insert(position, std::move(group));
+  }
+
+  // ordered by specificity, then by the registration of the mask
+  std::vector<Group> _groups;
+  size_t _size = 0;
+};
+
+} // namespace mcan
@@ -27,10 +27,20 @@ SOFTWARE.
 #pragma once
 
 #include "can_base.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bitset>
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 /*
 
@@ -54,6 +64,21 @@ namespace mcan {
 
 static constexpr size_t MAX_STRUCT_SIZE = 16320;
 
+/// @brief Unique ids from MCAN_FLOW_CONTROL_UID up are reserved for flow control
+/// frames, see mc_flow_control.hpp, no message may use one as its k_base_address.
+/// A status request has the unique id MCAN_FLOW_CONTROL_UID | node id of the sender, the
+/// status answering it MCAN_FLOW_STATUS_UID | node id of the sender, so each identifier
+/// is only ever sent by one node.
+static constexpr uint32_t MCAN_FLOW_CONTROL_UID = 0x1FFE00;
+static constexpr uint32_t MCAN_FLOW_STATUS_UID = 0x1FFF00;
+
+/// @brief Check if the unique id is reserved for flow control frames.
+inline constexpr bool
+mcan_is_flow_control_uid(uint32_t uid_21_bit)
+{
+  return uid_21_bit >= MCAN_FLOW_CONTROL_UID && uid_21_bit <= 0x1FFFFF;
+}
+
 enum class DeviceMode : std::uint8_t
 {
   UNDEFINED = 0,
@@ -61,15 +86,213 @@ enum class DeviceMode : std::uint8_t
   CONFIGURATION = 2,
 };
 
+/// @brief Payload bytes of one fragment of a multi frame message with a one byte
+/// index, the first data byte of every fragment is its index.
+/// @note Messages of more than 256 fragments use a wider header, see
+/// mcan_transfer_chunk_size().
+inline constexpr size_t
+mcan_chunk_size(bool is_fd)
+{
+  return is_fd ? CAN_FD_MAX_DATA_LENGTH - 1 : CAN_MAX_DATA_LENGTH - 1;
+}
+
+/// @brief Number of fragments needed to send size bytes.
+inline constexpr size_t
+mcan_fragment_count(size_t size, size_t chunk_size)
+{
+  return size / chunk_size + ((size % chunk_size) ? 1 : 0);
+}
+
+/// @brief Multi frame messages of T use tagged transfers if T declares
+/// static constexpr bool k_tagged_transfer = true.
+/// Every fragment of a tagged transfer carries a generation byte after the index and
+/// the payload is followed by a trailer with the message length and a CRC of it:
+/// | index | generation | payload ... | length (2 bytes) | CRC-16 (2 bytes) |
+/// A receiver drops a partial message as soon as a fragment of a newer generation
+/// arrives, and rejects a complete one that does not match the trailer, so fragments of
+/// a restarted transfer are never mixed into the message.
+/// @note Both sides have to agree on the format, it is part of the message definition.
+template<typename T>
+inline constexpr bool mcan_tagged_transfer_v = requires {
+  requires T::k_tagged_transfer;
+};
+
+/// @brief Bytes of the trailer of a tagged transfer, length and CRC-16.
+static constexpr size_t MCAN_TRANSFER_TRAILER_SIZE = 4;
+
+namespace detail {
+
+inline constexpr auto k_crc16_table = [] {
+  std::array<uint16_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    auto crc = static_cast<uint16_t>(i << 8);
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+} // namespace detail
+
+/// @brief CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) of the data.
+inline constexpr uint16_t
+mcan_crc16(const uint8_t* data, size_t size, uint16_t crc = 0xFFFF)
+{
+  for (size_t i = 0; i < size; ++i) {
+    crc = static_cast<uint16_t>((crc << 8) ^ detail::k_crc16_table[(crc >> 8) ^ data[i]]);
+  }
+  return crc;
+}
+
+/// @brief Bytes sent in a multi frame transfer of T, including the trailer of a tagged
+/// transfer.
+template<typename T>
+inline constexpr size_t
+mcan_transfer_size()
+{
+  if constexpr (mcan_tagged_transfer_v<T>) {
+    return sizeof(T::value) + MCAN_TRANSFER_TRAILER_SIZE;
+  } else {
+    return sizeof(T::value);
+  }
+}
+
+/// @brief Multi frame messages of T use a two byte (little endian) fragment index if a
+/// classic CAN transfer with a one byte index would need more than 256 fragments, that
+/// is messages of more than 1792 bytes (1532 for tagged transfers). Both frame formats
+/// use the same header then, so the index covers MAX_STRUCT_SIZE either way:
+/// | index (2 bytes) | [generation] | payload ... |
+template<typename T>
+inline constexpr bool mcan_wide_index_v =
+  mcan_fragment_count(mcan_transfer_size<T>(),
+                      mcan_chunk_size(false) - (mcan_tagged_transfer_v<T> ? 1 : 0)) > 256;
+
+/// @brief Bytes in front of the payload of every fragment of T, the index and the
+/// generation of a tagged transfer.
+template<typename T>
+inline constexpr size_t
+mcan_fragment_header_size()
+{
+  return (mcan_wide_index_v<T> ? 2 : 1) + (mcan_tagged_transfer_v<T> ? 1 : 0);
+}
+
+/// @brief Payload bytes of one fragment of a multi frame transfer of T.
+template<typename T>
+inline constexpr size_t
+mcan_transfer_chunk_size(bool is_fd)
+{
+  return (is_fd ? CAN_FD_MAX_DATA_LENGTH : CAN_MAX_DATA_LENGTH) -
+         mcan_fragment_header_size<T>();
+}
+
+/// @brief Fragment count of a multi frame transfer of T in the frame format.
+template<typename T>
+inline constexpr size_t
+mcan_transfer_fragment_count(bool is_fd)
+{
+  return mcan_fragment_count(mcan_transfer_size<T>(), mcan_transfer_chunk_size<T>(is_fd));
+}
+
+/// @brief Part of the transfer of a multi frame message carried by one fragment.
+struct McanFragment
+{
+  uint16_t offset;
+  uint16_t size;
+};
+
+/// @brief Layout of every fragment of a multi frame transfer in one frame format.
+template<size_t Count>
+struct McanFragmentPlan
+{
+  static constexpr size_t count = Count;
+
+  size_t chunk_size;
+  std::array<McanFragment, Count> fragments;
+};
+
+/// @brief Compile time description of the message T, derived from T::k_base_address and
+/// T::value. Sizes, the fragment header and the fragment plans of both frame formats are
+/// constants, so packing and unpacking do no size arithmetic at run time.
+template<typename T>
+struct MessageDescriptor
+{
+  using Type = T::Type;
+
+  static constexpr uint32_t base_address = T::k_base_address;
+  /// @brief Bytes of the message, the size of T::value.
+  static constexpr size_t message_size = sizeof(T::value);
+  /// @brief Messages of up to 8 bytes are sent as one frame without a header.
+  static constexpr bool single_frame = message_size <= CAN_MAX_DATA_LENGTH;
+  static constexpr bool tagged = mcan_tagged_transfer_v<T>;
+  static constexpr size_t transfer_size = mcan_transfer_size<T>();
+  static constexpr size_t header_size = mcan_fragment_header_size<T>();
+  /// @brief Transfers of at most this many fragments are packed and unpacked by fully
+  /// unrolled code, longer ones look their fragments up in the plan.
+  static constexpr size_t unroll_limit = 16;
+
+  static_assert(message_size <= MAX_STRUCT_SIZE, "Struct size too big to send over CAN");
+
+  /// @brief Fragments of a multi frame transfer of T in classic CAN (IsFd = false) or
+  /// CAN FD frames.
+  template<bool IsFd>
+  static constexpr auto plan = [] {
+    constexpr size_t chunk_size = mcan_transfer_chunk_size<T>(IsFd);
+    McanFragmentPlan<mcan_fragment_count(transfer_size, chunk_size)> result{};
+    result.chunk_size = chunk_size;
+    for (size_t index = 0; index < result.count; ++index) {
+      const size_t offset = index * chunk_size;
+      result.fragments[index] = {
+        static_cast<uint16_t>(offset),
+        static_cast<uint16_t>(std::min(chunk_size, transfer_size - offset))
+      };
+    }
+    return result;
+  }();
+};
+
 template<typename T>
 struct CanMultiPackageFrame
 {
   static_assert(sizeof(T) <= 16320, "Struct size too big to send over CAN");
-  static constexpr size_t expected_index_count =
-    sizeof(T) / 7 + ((sizeof(T) % 7) ? 1 : 0);
+  /// @brief Fragment count of a classic CAN transfer, the upper bound for any transfer.
+  static constexpr size_t expected_index_count = mcan_transfer_fragment_count<T>(false);
   using Type = T::Type;
   Type value;
   std::bitset<expected_index_count> received;
+  /// @brief Chunk size of the transfer being received, taken from the first fragment
+  /// (see mcan_transfer_chunk_size()), 0 before that.
+  size_t chunk_size = 0;
+  /// @brief Generation and trailer of a tagged transfer being received.
+  uint8_t generation = 0;
+  std::array<uint8_t, MCAN_TRANSFER_TRAILER_SIZE> trailer{};
+};
+
+/// @brief Reassembly state of a message received straight into memory owned by the
+/// caller, fragments are written to *value as they arrive so the complete message needs
+/// no further copy. The caller keeps value valid until the message is complete or
+/// abandoned.
+template<typename T>
+struct CanMultiPackageView
+{
+  static_assert(sizeof(T) <= 16320, "Struct size too big to send over CAN");
+  static constexpr size_t expected_index_count =
+    CanMultiPackageFrame<T>::expected_index_count;
+  using Type = T::Type;
+
+  explicit CanMultiPackageView(Type& destination)
+    : value(&destination)
+  {
+  }
+
+  Type* value;
+  std::bitset<expected_index_count> received;
+  /// @brief Chunk size of the transfer being received, see CanMultiPackageFrame.
+  size_t chunk_size = 0;
+  /// @brief Generation and trailer of a tagged transfer being received.
+  uint8_t generation = 0;
+  std::array<uint8_t, MCAN_TRANSFER_TRAILER_SIZE> trailer{};
 };
 
 inline constexpr uint32_t
@@ -80,6 +303,192 @@ mcan_connect_msg_id_with_node_id(uint32_t uid_21_bit,
   return (uid_21_bit << 8) | node_id | (remote ? CAN_REMOTE_REQUEST_FLAG : 0);
 }
 
+namespace detail {
+
+/// @brief Generation of the next tagged transfer of T sent by this process.
+template<typename T>
+uint8_t
+mcan_next_generation()
+{
+  static std::atomic<uint8_t> generation{ 0 };
+  return generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// @brief Copy size bytes at offset of a tagged transfer, the message followed by the
+/// trailer, to destination.
+inline void
+mcan_copy_from_transfer(uint8_t* destination,
+                        const uint8_t* message,
+                        size_t message_size,
+                        const uint8_t* trailer,
+                        size_t offset,
+                        size_t size)
+{
+  size_t from_message = offset < message_size ? std::min(size, message_size - offset) : 0;
+  std::memcpy(destination, message + offset, from_message);
+  if (size > from_message) {
+    std::memcpy(destination + from_message,
+                trailer + (offset + from_message - message_size),
+                size - from_message);
+  }
+}
+
+/// @brief Counterpart of mcan_copy_from_transfer() for the receiver.
+inline void
+mcan_copy_to_transfer(uint8_t* message,
+                      size_t message_size,
+                      uint8_t* trailer,
+                      size_t trailer_size,
+                      size_t offset,
+                      const uint8_t* source,
+                      size_t size)
+{
+  size_t to_message = offset < message_size ? std::min(size, message_size - offset) : 0;
+  std::memcpy(message + offset, source, to_message);
+  if (size > to_message) {
+    size_t trailer_offset = offset + to_message - message_size;
+    if (trailer_offset < trailer_size) {
+      std::memcpy(trailer + trailer_offset,
+                  source + to_message,
+                  std::min(size - to_message, trailer_size - trailer_offset));
+    }
+  }
+}
+
+/// @brief Copy a fragment payload, full chunks are copied with a constant size the
+/// compiler can inline.
+template<size_t ChunkSize>
+inline void
+mcan_copy_chunk(uint8_t* destination, const uint8_t* source, size_t size)
+{
+  if (size == ChunkSize) {
+    std::memcpy(destination, source, ChunkSize);
+  } else {
+    std::memcpy(destination, source, size);
+  }
+}
+
+/// @brief Builds the fragments of one multi frame transfer of T. Any fragment can be
+/// built at any time, so a transfer can be sent at once or paced and partially repeated
+/// (see mc_flow_control.hpp).
+template<typename T>
+class McanTransferEncoder
+{
+ public:
+  McanTransferEncoder(const T& message, uint32_t id, bool is_fd)
+    : _data(reinterpret_cast<const uint8_t*>(&message.value))
+    , _id(id)
+    , _is_fd(is_fd)
+  {
+    if constexpr (Descriptor::tagged) {
+      // tagged transfer, see mcan_tagged_transfer_v
+      const uint16_t crc = mcan_crc16(_data, Descriptor::message_size);
+      _trailer = { static_cast<uint8_t>(Descriptor::message_size & 0xFF),
+                   static_cast<uint8_t>(Descriptor::message_size >> 8),
+                   static_cast<uint8_t>(crc & 0xFF),
+                   static_cast<uint8_t>(crc >> 8) };
+      _generation = mcan_next_generation<T>();
+    }
+  }
+
+  size_t fragment_count() const
+  {
+    return _is_fd ? Descriptor::template plan<true>.count
+                  : Descriptor::template plan<false>.count;
+  }
+
+  void encode(size_t frame_index, CanFrame& frame) const
+  {
+    if (_is_fd) {
+      encode<true>(frame_index, frame);
+    } else {
+      encode<false>(frame_index, frame);
+    }
+  }
+
+  /// @brief encode() of a transfer in IsFd frames.
+  template<bool IsFd>
+  void encode(size_t frame_index, CanFrame& frame) const
+  {
+    const McanFragment& fragment = Descriptor::template plan<IsFd>.fragments[frame_index];
+    encode<IsFd>(frame_index, fragment, frame);
+  }
+
+  /// @brief encode() of a fragment known at compile time, the copies get constant sizes.
+  template<bool IsFd, size_t Index>
+  void encode(CanFrame& frame) const
+  {
+    encode<IsFd>(Index, Descriptor::template plan<IsFd>.fragments[Index], frame);
+  }
+
+ private:
+  using Descriptor = MessageDescriptor<T>;
+
+  template<bool IsFd>
+  void encode(size_t frame_index, const McanFragment& fragment, CanFrame& frame) const
+  {
+    frame.id = _id;
+    frame.is_extended = true;
+    frame.is_remote_request = false;
+    frame.is_fd = _is_fd;
+    frame.bit_rate_switch = _is_fd;
+    // the header starts with the frame index
+    frame.data[0] = static_cast<uint8_t>(frame_index);
+    if constexpr (mcan_wide_index_v<T>) {
+      frame.data[1] = static_cast<uint8_t>(frame_index >> 8);
+    }
+    frame.size = static_cast<uint8_t>(Descriptor::header_size + fragment.size);
+    uint8_t* payload = &frame.data[Descriptor::header_size];
+    if constexpr (Descriptor::tagged) {
+      frame.data[Descriptor::header_size - 1] = _generation;
+      mcan_copy_from_transfer(payload,
+                              _data,
+                              Descriptor::message_size,
+                              _trailer.data(),
+                              fragment.offset,
+                              fragment.size);
+    } else {
+      mcan_copy_chunk<Descriptor::template plan<IsFd>.chunk_size>(
+        payload, _data + fragment.offset, fragment.size);
+    }
+  }
+
+  const uint8_t* _data;
+  uint32_t _id;
+  bool _is_fd;
+  uint8_t _generation = 0;
+  std::array<uint8_t, MCAN_TRANSFER_TRAILER_SIZE> _trailer{};
+};
+
+/// @brief Send every fragment of the transfer in IsFd frames, stops at the first frame
+/// that can not be sent.
+template<typename T, bool IsFd>
+Status
+mcan_send_fragments(CanBase& can_interface, const McanTransferEncoder<T>& encoder)
+{
+  using Descriptor = MessageDescriptor<T>;
+  constexpr size_t count = Descriptor::template plan<IsFd>.count;
+  CanFrame frame;
+  if constexpr (count <= Descriptor::unroll_limit) {
+    Status status = Status::OK();
+    [&]<size_t... Index>(std::index_sequence<Index...>) {
+      (void)((encoder.template encode<IsFd, Index>(frame),
+              status = can_interface.send(frame),
+              status.ok()) &&
+             ...);
+    }(std::make_index_sequence<count>{});
+    return status;
+  } else {
+    for (size_t frame_index = 0; frame_index < count; ++frame_index) {
+      encoder.template encode<IsFd>(frame_index, frame);
+      ARI_RETURN_ON_ERROR(can_interface.send(frame));
+    }
+    return Status::OK();
+  }
+}
+
+} // namespace detail
+
 template<typename T>
 Status
 mcan_pack_send_msg(mcan::CanBase& can_interface,
@@ -99,7 +508,7 @@ mcan_pack_send_msg(mcan::CanBase& can_interface,
     frame.id = mcan_connect_msg_id_with_node_id(T::k_base_address, node_id);
   }
 
-  if constexpr (sizeof(T::value) <= 8) {
+  if constexpr (MessageDescriptor<T>::single_frame) {
     frame.size = sizeof(T::value);
     std::memcpy(frame.data,
                 reinterpret_cast<const uint8_t*>(&struct_to_send.value),
@@ -111,23 +520,14 @@ mcan_pack_send_msg(mcan::CanBase& can_interface,
     // now since we have to send more than 8 bytes we will have to split the message into
     // multiple can frames, but sine the receiver knows which can id corresponds to which
     // message we can just send them one after another with adding index in the data.
-    int total_frames = (sizeof(T)) / 7;
-    if ((sizeof(T) % 7) != 0) {
-      total_frames += 1;
-    }
-    const uint8_t* data_ptr = reinterpret_cast<const uint8_t*>(&struct_to_send.value);
-    for (int frame_index = 0; frame_index < total_frames; ++frame_index) {
-      frame.size = (frame_index == total_frames - 1)
-                     ? ((sizeof(T::value) - (frame_index * 7)) + 1)
-                     : 8;
-      frame.data[0] = static_cast<uint8_t>(frame_index); // first byte is frame index
-      std::memcpy(&frame.data[1], &data_ptr[frame_index * 7], frame.size - 1);
-      frame.is_extended = true;
-      frame.is_remote_request = false;
-      ARI_RETURN_ON_ERROR(can_interface.send(frame));
+    // On a CAN FD bus every fragment carries up to 63 bytes instead of 7.
+    const bool is_fd = can_interface.supports_fd();
+    detail::McanTransferEncoder<T> encoder(struct_to_send, frame.id, is_fd);
+    if (is_fd) {
+      return detail::mcan_send_fragments<T, true>(can_interface, encoder);
     }
+    return detail::mcan_send_fragments<T, false>(can_interface, encoder);
   }
-  return Status::OK();
 }
 
 template<typename T>
@@ -150,52 +550,193 @@ mcan_request_msg(mcan::CanBase& can_interface, const T& struct_to_send, uint8_t
   return can_interface.send(frame);
 }
 
-/// @brief Unpack a received CAN frame into the provided structure.
-/// @tparam T The type of the structure to unpack into.
-/// @param frame The received CAN frame.
-/// @param struct_to_receive The structure to unpack the data into.
-/// @return Status of the operation.
-/// Status can be Cancelled if more frames are needed to complete the message. Ok if
-/// message is complete.
-///
+namespace detail {
+
+/// @brief Index of a fragment of a multi frame message of T, see mcan_wide_index_v.
 template<typename T>
+inline size_t
+mcan_fragment_index(const CanFrame& frame)
+{
+  if constexpr (mcan_wide_index_v<T>) {
+    return frame.data[0] | (static_cast<size_t>(frame.data[1]) << 8);
+  } else {
+    return frame.data[0];
+  }
+}
+
+/// @brief Copy the payload of the fragment into the message, or its trailer.
+/// @return false if the frame is too short for the fragment.
+template<typename T, bool IsFd, typename State>
+bool
+mcan_copy_fragment(const McanFragment& fragment,
+                   const CanFrame& frame,
+                   typename T::Type& value,
+                   State& state)
+{
+  using Descriptor = MessageDescriptor<T>;
+  // CAN FD frames can be padded past the end of the fragment
+  if (frame.size < Descriptor::header_size + fragment.size) {
+    return false;
+  }
+  uint8_t* destination = reinterpret_cast<uint8_t*>(&value);
+  const uint8_t* payload = &frame.data[Descriptor::header_size];
+  if constexpr (Descriptor::tagged) {
+    mcan_copy_to_transfer(destination,
+                          Descriptor::message_size,
+                          state.trailer.data(),
+                          state.trailer.size(),
+                          fragment.offset,
+                          payload,
+                          fragment.size);
+  } else {
+    (void)state;
+    mcan_copy_chunk<Descriptor::template plan<IsFd>.chunk_size>(
+      destination + fragment.offset, payload, fragment.size);
+  }
+  return true;
+}
+
+/// @brief Unpack one fragment of a transfer in IsFd frames.
+template<typename T, bool IsFd, typename State>
 Status
-mcan_unpack_msg(const CanFrame& frame, CanMultiPackageFrame<T>& struct_to_receive)
+mcan_unpack_fragment(const CanFrame& frame, typename T::Type& value, State& state)
+{
+  using Descriptor = MessageDescriptor<T>;
+  constexpr auto& plan = Descriptor::template plan<IsFd>;
+  if (frame.size < Descriptor::header_size) {
+    state.received.reset();
+    if constexpr (!Descriptor::tagged) {
+      value = {};
+    }
+    return Status::Invalid(
+      "Received CAN frame is too short for a multi frame message"_status);
+  }
+  if constexpr (Descriptor::tagged) {
+    const uint8_t generation = frame.data[Descriptor::header_size - 1];
+    if (state.chunk_size != plan.chunk_size || state.generation != generation ||
+        state.received.count() == plan.count) {
+      // a fragment of another transfer, whatever was received so far is stale, or the
+      // first fragment after a complete message
+      state.received.reset();
+      state.chunk_size = plan.chunk_size;
+      state.generation = generation;
+    }
+  } else {
+    // the chunk size follows the frame format the sender used
+    if (state.chunk_size != plan.chunk_size) {
+      if (state.chunk_size != 0) {
+        // the sender switched the frame format, start over
+        state.received.reset();
+      }
+      state.chunk_size = plan.chunk_size;
+    } else if (state.received.count() == plan.count) {
+      // first fragment after a complete message
+      state.received.reset();
+    }
+  }
+  const size_t index = mcan_fragment_index<T>(frame);
+  bool copied = false;
+  if constexpr (plan.count <= Descriptor::unroll_limit) {
+    // a switch over the index, every case copies a constant number of bytes
+    [&]<size_t... Index>(std::index_sequence<Index...>) {
+      (void)((index == Index &&
+              (copied = mcan_copy_fragment<T, IsFd>(
+                 plan.fragments[Index], frame, value, state),
+               true)) ||
+             ...);
+    }(std::make_index_sequence<plan.count>{});
+  } else if (index < plan.count) {
+    copied = mcan_copy_fragment<T, IsFd>(plan.fragments[index], frame, value, state);
+  }
+  if (!copied) {
+    state.received.reset();
+    if constexpr (!Descriptor::tagged) {
+      value = {};
+    }
+    return index < plan.count
+             ? Status::Invalid("Received CAN frame is too short for its fragment"_status)
+             : Status::Invalid("Received CAN frame index out of bounds"_status);
+  }
+  state.received.set(index);
+  if (state.received.count() != plan.count) {
+    return Status::Cancelled(
+      "Waiting for more CAN frames to complete the message"_status);
+  }
+  if constexpr (Descriptor::tagged) {
+    const size_t length = state.trailer[0] | (state.trailer[1] << 8);
+    const auto crc = static_cast<uint16_t>(state.trailer[2] | (state.trailer[3] << 8));
+    if (length != Descriptor::message_size ||
+        crc != mcan_crc16(reinterpret_cast<const uint8_t*>(&value),
+                          Descriptor::message_size)) {
+      state.received.reset();
+      return Status::Invalid(
+        "Received CAN message does not match its length or CRC"_status);
+    }
+  }
+  return Status::OK();
+}
+
+template<typename T, typename State>
+Status
+mcan_unpack_into(const CanFrame& frame, typename T::Type& value, State& state)
 {
   static_assert(
     std::is_member_pointer_v<decltype(T::k_base_address)> || requires {
       T::k_base_address;
     }, "Type T must have k_base_address member or constant");
-  if constexpr (sizeof(T::value) <= 8) {
+  if constexpr (MessageDescriptor<T>::single_frame) {
+    (void)state;
     if (frame.size != sizeof(T::value)) {
-      return Status::Invalid("Received CAN frame size does not match expected size");
+      return Status::Invalid(
+        "Received CAN frame size does not match expected size"_status);
     }
-    std::memcpy(
-      reinterpret_cast<uint8_t*>(&struct_to_receive.value), frame.data, sizeof(T::value));
+    std::memcpy(reinterpret_cast<uint8_t*>(&value), frame.data, sizeof(T::value));
     return Status::OK();
+  } else if (frame.is_fd) {
+    return mcan_unpack_fragment<T, true>(frame, value, state);
   } else {
     // we have to receive multiple frames to reconstruct the message
-    size_t index = frame.data[0];
-    if (index >= CanMultiPackageFrame<T>::expected_index_count) {
-      struct_to_receive.received.reset();
-      struct_to_receive.value = {};
-      return Status::Invalid("Received CAN frame index out of bounds");
-    }
-    size_t data_size = frame.size - 1;
-    std::memcpy(reinterpret_cast<uint8_t*>(&struct_to_receive.value) + (index * 7),
-                &frame.data[1],
-                data_size);
-    struct_to_receive.received.set(index);
-    if (struct_to_receive.received.all()) {
-      return Status::OK();
-    } else {
-      return Status::Cancelled("Waiting for more CAN frames to complete the message");
-    };
+    return mcan_unpack_fragment<T, false>(frame, value, state);
   }
 }
 
+} // namespace detail
+
+/// @brief Unpack a received CAN frame into the provided structure.
+/// @tparam T The type of the structure to unpack into.
+/// @param frame The received CAN frame.
+/// @param struct_to_receive The structure to unpack the data into.
+/// @return Status of the operation.
+/// Status can be Cancelled if more frames are needed to complete the message. Ok if
+/// message is complete.
+///
+template<typename T>
+Status
+mcan_unpack_msg(const CanFrame& frame, CanMultiPackageFrame<T>& struct_to_receive)
+{
+  return detail::mcan_unpack_into<T>(frame, struct_to_receive.value, struct_to_receive);
+}
+
+/// @brief Unpack a received CAN frame straight into the destination of the view.
+/// @return Same as the CanMultiPackageFrame overload, the message is in *view.value
+/// once OK is returned.
+template<typename T>
+Status
+mcan_unpack_msg(const CanFrame& frame, CanMultiPackageView<T>& view)
+{
+  return detail::mcan_unpack_into<T>(frame, *view.value, view);
+}
+
+/// @brief Request T from the node and wait for the response.
+/// Messages bigger than one frame are collected fragment by fragment through
+/// send_await_response_stream_async(), the timeout covers the whole message.
+/// @return OK once strcut_to_receive holds the message, TimeOut if it did not arrive
+/// completely in time, NotImplemented for multi frame messages if the driver does not
+/// support response streams.
+/// @note Fragments are written straight into strcut_to_receive, after an error it may
+/// hold a part of the message.
 template<typename T>
-Result<CanFrame>
+Result<void>
 mcan_request_and_await_msg(mcan::CanBase& can_interface,
                            T& strcut_to_receive,
                            uint8_t node_id,
@@ -205,7 +746,7 @@ mcan_request_and_await_msg(mcan::CanBase& can_interface,
     std::is_member_pointer_v<decltype(&T::k_base_address)> || requires {
       T::k_base_address;
     }, "Type T must have k_base_address member or constant");
-  static_assert(sizeof(T) <= 8, "Struct size too big to send over CAN");
+  static_assert(sizeof(T) <= MAX_STRUCT_SIZE, "Struct size too big to send over CAN");
   uint32_t expected_response_id =
     mcan_connect_msg_id_with_node_id(T::k_base_address, node_id, false);
   CanFrame frame;
@@ -213,13 +754,163 @@ mcan_request_and_await_msg(mcan::CanBase& can_interface,
   frame.size = 0;
   frame.is_extended = true;
   frame.is_remote_request = true;
-  ARI_ASIGN_OR_RETURN(
-    response, can_interface.send_await_response(frame, expected_response_id, timeout_ms));
 
-  CanMultiPackageFrame<T> buf_receive;
-  ARI_RETURN_ON_ERROR(mcan_unpack_msg(response, buf_receive));
-  strcut_to_receive.value = buf_receive.value;
-  return Status::OK();
+  if constexpr (sizeof(T::value) <= 8) {
+    ARI_ASIGN_OR_RETURN(
+      response,
+      can_interface.send_await_response(frame, expected_response_id, timeout_ms));
+
+    CanMultiPackageView<T> view(strcut_to_receive.value);
+    ARI_RETURN_ON_ERROR(mcan_unpack_msg(response, view));
+    return Result<void>::OK();
+  } else {
+    // shared with the handler, which may still run after we gave up waiting. Fragments
+    // are written straight into strcut_to_receive, but only until status is set, so
+    // nothing touches it once we returned.
+    struct Reassembly
+    {
+      explicit Reassembly(typename T::Type& destination)
+        : view(destination)
+      {
+      }
+
+      std::mutex mutex;
+      std::condition_variable cv;
+      CanMultiPackageView<T> view;
+      std::optional<Status> status;
+    };
+    auto reassembly = std::make_shared<Reassembly>(strcut_to_receive.value);
+    ARI_RETURN_ON_ERROR(can_interface.send_await_response_stream_async(
+      frame,
+      expected_response_id,
+      timeout_ms,
+      CanBase::response_stream_handler_type([reassembly](Result<CanFrame> response) {
+        std::lock_guard<std::mutex> lock(reassembly->mutex);
+        if (reassembly->status.has_value()) {
+          return false;
+        }
+        if (!response.ok()) {
+          reassembly->status.emplace(response.status());
+          reassembly->cv.notify_one();
+          return false;
+        }
+        Status status = mcan_unpack_msg(response.valueOrDie(), reassembly->view);
+        if (status.status_code() == StatusCode::Cancelled) {
+          // more fragments to come
+          return true;
+        }
+        reassembly->status.emplace(std::move(status));
+        reassembly->cv.notify_one();
+        return false;
+      })));
+
+    std::unique_lock<std::mutex> lock(reassembly->mutex);
+    // the driver times the stream out itself, our own deadline only matters when the
+    // RX side can not run, e.g. when called from a callback
+    bool done = reassembly->cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] {
+      return reassembly->status.has_value();
+    });
+    if (!done) {
+      reassembly->status.emplace(
+        Status::TimeOut("No response received for the CAN frame"_status));
+    }
+    if (!reassembly->status->ok()) {
+      return *reassembly->status;
+    }
+    return Result<void>::OK();
+  }
+}
+
+/// @brief Request T from every node in [first_node, last_node] at once and gather the
+/// responses. All remote requests are sent back to back through
+/// send_await_response_async() and share one deadline, so polling the whole bus takes
+/// about one round trip plus the time to transmit the requests instead of one round
+/// trip (or timeout) per node.
+/// @param timeout_ms Deadline of the whole poll, counted from the call.
+/// @return one Result per node, index 0 is first_node. Nodes that did not answer in
+/// time get TimeOut, nodes whose request could not be sent get the send error.
+template<typename T>
+std::vector<Result<T>>
+mcan_request_from_nodes(mcan::CanBase& can_interface,
+                        uint8_t first_node = 2,
+                        uint8_t last_node = 255,
+                        uint32_t timeout_ms = 1500)
+{
+  static_assert(
+    std::is_member_pointer_v<decltype(&T::k_base_address)> || requires {
+      T::k_base_address;
+    }, "Type T must have k_base_address member or constant");
+  static_assert(sizeof(T) <= 8, "Struct size too big to send over CAN");
+  if (first_node > last_node) {
+    return {};
+  }
+  const size_t node_count = static_cast<size_t>(last_node - first_node) + 1;
+
+  // shared with the handlers, which may still run after the deadline made us return
+  struct Gather
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::optional<Result<CanFrame>>> responses;
+    size_t remaining;
+  };
+  auto gather = std::make_shared<Gather>();
+  gather->responses.resize(node_count);
+  gather->remaining = node_count;
+
+  const auto deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  for (size_t i = 0; i < node_count; ++i) {
+    const auto node_id = static_cast<uint8_t>(first_node + i);
+    CanFrame frame;
+    frame.id = mcan_connect_msg_id_with_node_id(T::k_base_address, node_id, true);
+    frame.size = 0;
+    frame.is_extended = true;
+    frame.is_remote_request = true;
+    // every request gets what is left of the common deadline
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now());
+    Status status = can_interface.send_await_response_async(
+      frame,
+      mcan_connect_msg_id_with_node_id(T::k_base_address, node_id, false),
+      static_cast<uint32_t>(std::max<int64_t>(left.count(), 0)),
+      CanBase::response_handler_type([gather, i](Result<CanFrame> response) {
+        std::lock_guard<std::mutex> lock(gather->mutex);
+        gather->responses[i].emplace(std::move(response));
+        if (--gather->remaining == 0) {
+          gather->cv.notify_one();
+        }
+      }));
+    if (!status.ok()) {
+      std::lock_guard<std::mutex> lock(gather->mutex);
+      gather->responses[i].emplace(status);
+      --gather->remaining;
+    }
+  }
+
+  std::vector<Result<T>> results;
+  results.reserve(node_count);
+  std::unique_lock<std::mutex> lock(gather->mutex);
+  gather->cv.wait_until(lock, deadline, [&] { return gather->remaining == 0; });
+  for (std::optional<Result<CanFrame>>& response : gather->responses) {
+    if (!response.has_value()) {
+      results.push_back(Status::TimeOut("No response received for the CAN frame"_status));
+      continue;
+    }
+    if (!response->ok()) {
+      results.push_back(response->status());
+      continue;
+    }
+    T received;
+    CanMultiPackageView<T> view(received.value);
+    Status status = mcan_unpack_msg(response->valueOrDie(), view);
+    if (!status.ok()) {
+      results.push_back(status);
+      continue;
+    }
+    results.push_back(Result<T>::OK(std::move(received)));
+  }
+  return results;
 }
 
 } // namespace mcan
\ No newline at end of file
@@ -0,0 +1,404 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include "can_base.hpp"
+#include "mc_common.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace mcan {
+
+class CoroutineExecutor;
+
+template<typename T>
+class Task;
+
+namespace detail {
+
+struct TaskPromiseBase
+{
+  struct FinalAwaiter
+  {
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept;
+
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+
+  // the library does not use exceptions, a throwing task is a bug
+  void unhandled_exception() const noexcept { std::terminate(); }
+
+  // executor the task runs on, inherited from the task that awaits it
+  CoroutineExecutor* executor = nullptr;
+  // task awaiting this one, resumed when this one finishes
+  std::coroutine_handle<> continuation;
+  // started by CoroutineExecutor::spawn(), nobody awaits it and the frame frees itself
+  bool detached = false;
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase
+{
+  Task<T> get_return_object() noexcept;
+
+  void return_value(T value) { result.emplace(std::move(value)); }
+
+  std::optional<T> result;
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase
+{
+  Task<void> get_return_object() noexcept;
+
+  void return_void() const noexcept {}
+};
+
+} // namespace detail
+
+/// @brief Lazily started coroutine returning T, run it by co_await from another task
+/// or pass a Task<void> to CoroutineExecutor::spawn(). Awaiting a task starts it right
+/// away on the current thread and resumes the awaiting task as soon as it finishes,
+/// without a round trip through the executor.
+/// @note Exceptions thrown out of a task terminate the program, return a Result<T>
+/// instead.
+template<typename T = void>
+class [[nodiscard]] Task
+{
+ public:
+  using promise_type = detail::TaskPromise<T>;
+
+  Task(Task&& other) noexcept
+    : _handle(std::exchange(other._handle, nullptr))
+  {
+  }
+
+  Task& operator=(Task&& other) noexcept
+  {
+    if (this != &other) {
+      reset();
+      _handle = std::exchange(other._handle, nullptr);
+    }
+    return *this;
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() { reset(); }
+
+  struct Awaiter
+  {
+    std::coroutine_handle<promise_type> handle;
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<Promise> awaiting) noexcept
+    {
+      handle.promise().executor = awaiting.promise().executor;
+      handle.promise().continuation = awaiting;
+      return handle;
+    }
+
+    T await_resume()
+    {
+      if constexpr (!std::is_void_v<T>) {
+        return std::move(*handle.promise().result);
+      }
+    }
+  };
+
+  Awaiter operator co_await() && noexcept { return Awaiter{ _handle }; }
+
+ private:
+  friend promise_type;
+  friend class CoroutineExecutor;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+    : _handle(handle)
+  {
+  }
+
+  void reset()
+  {
+    if (_handle) {
+      _handle.destroy();
+      _handle = nullptr;
+    }
+  }
+
+  std::coroutine_handle<promise_type> _handle;
+};
+
+/// @brief Single thread executor of coroutine tasks.
+/// Tasks only run on the thread calling run() or poll(). Awaitables that complete on
+/// another thread, like mcan_request() completing on the RX thread of the driver, post
+/// the suspended task back here, so thousands of request flows share one thread and
+/// callbacks of the driver are never blocked by user code.
+/// @note The executor has to outlive its tasks, close the bus (which cancels pending
+/// requests) and run() until the tasks finished before destroying it.
+class CoroutineExecutor
+{
+ public:
+  CoroutineExecutor() = default;
+  CoroutineExecutor(const CoroutineExecutor&) = delete;
+  CoroutineExecutor& operator=(const CoroutineExecutor&) = delete;
+
+  /// @brief Start the task on the executor, it frees itself when it finishes.
+  /// @note Thread safe, the task starts on the next run()/poll().
+  void spawn(Task<void> task)
+  {
+    auto handle = std::exchange(task._handle, nullptr);
+    handle.promise().executor = this;
+    handle.promise().detached = true;
+    ++_task_count;
+    post(handle);
+  }
+
+  /// @brief Queue a suspended coroutine to be resumed by the executor.
+  /// @note Thread safe.
+  void post(std::coroutine_handle<> handle)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _ready.push_back(handle);
+    }
+    _cv.notify_one();
+  }
+
+  /// @brief Resume every queued coroutine without blocking, including the ones queued
+  /// meanwhile.
+  /// @return number of resumed coroutines.
+  size_t poll()
+  {
+    size_t count = 0;
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_ready.empty()) {
+          return count;
+        }
+        _running.swap(_ready);
+      }
+      for (std::coroutine_handle<> handle : _running) {
+        handle.resume();
+      }
+      count += _running.size();
+      _running.clear();
+    }
+  }
+
+  /// @brief Run until every spawned task finished or stop() was called.
+  void run()
+  {
+    _stopped = false;
+    while (true) {
+      poll();
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this] { return !_ready.empty() || _stopped || _task_count == 0; });
+      if (_ready.empty() && (_stopped || _task_count == 0)) {
+        return;
+      }
+    }
+  }
+
+  /// @brief Make run() return once the queued coroutines were resumed.
+  /// @note Thread safe.
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopped = true;
+    }
+    _cv.notify_one();
+  }
+
+  /// @brief Number of spawned tasks that did not finish yet.
+  size_t task_count() const { return _task_count; }
+
+ private:
+  friend struct detail::TaskPromiseBase;
+
+  void task_finished()
+  {
+    {
+      // under the lock so run() can not miss the last task finishing
+      std::lock_guard<std::mutex> lock(_mutex);
+      --_task_count;
+    }
+    _cv.notify_one();
+  }
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::vector<std::coroutine_handle<>> _ready;
+  // only touched by the thread in poll()
+  std::vector<std::coroutine_handle<>> _running;
+  std::atomic<size_t> _task_count{ 0 };
+  bool _stopped = false;
+};
+
+namespace detail {
+
+template<typename Promise>
+std::coroutine_handle<>
+TaskPromiseBase::FinalAwaiter::await_suspend(
+  std::coroutine_handle<Promise> handle) noexcept
+{
+  TaskPromiseBase& promise = handle.promise();
+  if (promise.continuation) {
+    return promise.continuation;
+  }
+  if (promise.detached) {
+    CoroutineExecutor* executor = promise.executor;
+    handle.destroy();
+    executor->task_finished();
+  }
+  return std::noop_coroutine();
+}
+
+template<typename T>
+Task<T>
+TaskPromise<T>::get_return_object() noexcept
+{
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void>
+TaskPromise<void>::get_return_object() noexcept
+{
+  return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/// @brief Awaitable returned by mcan_request().
+template<typename T>
+class McanRequestAwaitable
+{
+ public:
+  McanRequestAwaitable(CanBase& can_interface, uint8_t node_id, uint32_t timeout_ms)
+    : _can_interface(can_interface)
+    , _node_id(node_id)
+    , _timeout_ms(timeout_ms)
+  {
+  }
+
+  McanRequestAwaitable(const McanRequestAwaitable&) = delete;
+  McanRequestAwaitable& operator=(const McanRequestAwaitable&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+
+  template<typename Promise>
+  bool await_suspend(std::coroutine_handle<Promise> awaiting)
+  {
+    _executor = awaiting.promise().executor;
+    _awaiting = awaiting;
+    CanFrame frame;
+    frame.id = mcan_connect_msg_id_with_node_id(T::k_base_address, _node_id, true);
+    frame.size = 0;
+    frame.is_extended = true;
+    frame.is_remote_request = true;
+    Status status = _can_interface.send_await_response_async(
+      frame,
+      mcan_connect_msg_id_with_node_id(T::k_base_address, _node_id, false),
+      _timeout_ms,
+      CanBase::response_handler_type([this](Result<CanFrame> response) {
+        _response.emplace(std::move(response));
+        _executor->post(_awaiting);
+      }));
+    if (!status.ok()) {
+      // the handler is not called, resume right away with the error
+      _response.emplace(status);
+      return false;
+    }
+    return true;
+  }
+
+  Result<T> await_resume()
+  {
+    if (!_response->ok()) {
+      return _response->status();
+    }
+    T received;
+    CanMultiPackageView<T> view(received.value);
+    Status status = mcan_unpack_msg(_response->valueOrDie(), view);
+    if (!status.ok()) {
+      return status;
+    }
+    return Result<T>::OK(std::move(received));
+  }
+
+ private:
+  CanBase& _can_interface;
+  uint8_t _node_id;
+  uint32_t _timeout_ms;
+  CoroutineExecutor* _executor = nullptr;
+  std::coroutine_handle<> _awaiting;
+  std::optional<Result<CanFrame>> _response;
+};
+
+/// @brief Coroutine version of mcan_request_and_await_msg(): request T from the node
+/// and suspend the awaiting task until the response arrives, without blocking a thread.
+///   Task<void> poll(CanBase& bus) {
+///     Result<Temperature> temperature = co_await mcan_request<Temperature>(bus, 5);
+///     ...
+///   }
+///   executor.spawn(poll(bus));
+///   executor.run();
+/// @note Can only be awaited from a Task running on a CoroutineExecutor, the task is
+/// resumed there. The response is matched by send_await_response_async().
+/// @return Result with the received message, TimeOut if the node did not answer in
+/// time or the error of sending the request.
+template<typename T>
+McanRequestAwaitable<T>
+mcan_request(CanBase& can_interface, uint8_t node_id, uint32_t timeout_ms = 1500)
+{
+  static_assert(
+    std::is_member_pointer_v<decltype(&T::k_base_address)> || requires {
+      T::k_base_address;
+    }, "Type T must have k_base_address member or constant");
+  static_assert(sizeof(T) <= 8, "Struct size too big to send over CAN");
+  return McanRequestAwaitable<T>(can_interface, node_id, timeout_ms);
+}
+
+} // namespace mcan
@@ -0,0 +1,297 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include "can_base.hpp"
+#include "mc_common.hpp"
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <thread>
+
+/*
+
+FLOW CONTROLLED TRANSFERS
+
+A flow controlled transfer uses the regular fragments of a multi frame message, the
+sender only paces them and lets the receiver report what is missing. The handshake uses
+flow control frames with the node id of the message, each direction with its own
+reserved unique id that also carries the node id of the sender:
+
+status request, sender -> receiver after every block
+unique id MCAN_FLOW_CONTROL_UID | sender node id
+| uid of the message (3 bytes, little endian) | 0 |
+status, receiver -> sender
+unique id MCAN_FLOW_STATUS_UID | sender node id
+| uid of the message (3 bytes) | 1 | first missing index (2 bytes) | bitmap (2 bytes) |
+
+So the sender and the receiver never send the same identifier, and senders with
+different node ids only see the statuses meant for them. A sender runs one flow
+controlled transfer per receiver at a time, the uid in the status tells a stale one
+apart.
+
+The first missing index is 0xFFFF once the message is complete, bit i of the bitmap
+tells that fragment first_missing + 1 + i arrived. The sender sends the next block from
+the fragments known to be missing and the ones not sent yet, so a lost fragment costs
+one frame instead of the whole message.
+
+*/
+
+namespace mcan {
+
+/// @brief First missing index of a complete message in a flow control status.
+static constexpr uint16_t MCAN_FLOW_CONTROL_COMPLETE = 0xFFFF;
+
+/// @brief Settings of mcan_pack_send_msg_flow_controlled().
+struct McanFlowControl
+{
+  /// @brief Fragments sent before asking the receiver for its status.
+  size_t block_size = 16;
+
+  /// @brief Minimum time between two frames sent to the receiver.
+  uint32_t separation_time_us = 0;
+
+  /// @brief Time to wait for a status of the receiver.
+  uint32_t status_timeout_ms = 100;
+
+  /// @brief Status requests in a row that may go unanswered before giving up.
+  size_t max_retries = 3;
+
+  /// @brief Blocks in a row after which the receiver may report no new fragment
+  /// before giving up, a receiver that answers but never makes progress would keep the
+  /// sender retransmitting forever otherwise.
+  size_t max_stalled_rounds = 8;
+
+  /// @brief Node id of the sender, part of the identifiers of the handshake. Nodes
+  /// sending flow controlled transfers to the same receiver need distinct ids, the
+  /// default is the master.
+  uint8_t sender_node_id = 1;
+};
+
+namespace detail {
+
+enum class McanFlowControlKind : uint8_t
+{
+  StatusRequest = 0,
+  Status = 1,
+};
+
+/// @brief Identifier of a flow control frame of the kind between the sender and the
+/// receiver with node_id.
+inline constexpr uint32_t
+mcan_flow_control_id(uint8_t node_id, uint8_t sender_node_id, McanFlowControlKind kind)
+{
+  const uint32_t uid = kind == McanFlowControlKind::StatusRequest ? MCAN_FLOW_CONTROL_UID
+                                                                   : MCAN_FLOW_STATUS_UID;
+  return mcan_connect_msg_id_with_node_id(uid | sender_node_id, node_id);
+}
+
+inline CanFrame
+mcan_flow_control_frame(uint32_t uid,
+                        uint8_t node_id,
+                        uint8_t sender_node_id,
+                        McanFlowControlKind kind)
+{
+  CanFrame frame;
+  frame.id = mcan_flow_control_id(node_id, sender_node_id, kind);
+  frame.is_extended = true;
+  frame.is_remote_request = false;
+  frame.size = 4;
+  frame.data[0] = static_cast<uint8_t>(uid & 0xFF);
+  frame.data[1] = static_cast<uint8_t>((uid >> 8) & 0xFF);
+  frame.data[2] = static_cast<uint8_t>((uid >> 16) & 0xFF);
+  frame.data[3] = static_cast<uint8_t>(kind);
+  return frame;
+}
+
+inline bool
+mcan_is_flow_control_frame(const CanFrame& frame, uint32_t uid, McanFlowControlKind kind)
+{
+  const uint32_t reserved_uid = kind == McanFlowControlKind::StatusRequest
+                                  ? MCAN_FLOW_CONTROL_UID
+                                  : MCAN_FLOW_STATUS_UID;
+  return frame.is_extended && ((frame.id >> 8) & ~0xFFu) == reserved_uid &&
+         frame.size >= 4 &&
+         static_cast<uint32_t>(frame.data[0] | (frame.data[1] << 8) |
+                               (frame.data[2] << 16)) == uid &&
+         frame.data[3] == static_cast<uint8_t>(kind);
+}
+
+} // namespace detail
+
+/// @brief Check if the frame asks for the status of a flow controlled transfer of T,
+/// the receiver answers it with mcan_send_flow_status().
+template<typename T>
+bool
+mcan_is_flow_status_request(const CanFrame& frame)
+{
+  return detail::mcan_is_flow_control_frame(
+    frame, T::k_base_address, detail::McanFlowControlKind::StatusRequest);
+}
+
+/// @brief Report the reassembly state of a flow controlled transfer of T to the sender.
+/// @param request Status request of the sender, see mcan_is_flow_status_request(), the
+/// status goes back to the node that sent it.
+/// @param state CanMultiPackageFrame<T> or CanMultiPackageView<T> the fragments are
+/// unpacked into.
+template<typename T, typename State>
+Status
+mcan_send_flow_status(CanBase& can_interface, const CanFrame& request, const State& state)
+{
+  CanFrame frame =
+    detail::mcan_flow_control_frame(T::k_base_address,
+                                    static_cast<uint8_t>(request.id & 0xFF),
+                                    static_cast<uint8_t>((request.id >> 8) & 0xFF),
+                                    detail::McanFlowControlKind::Status);
+  size_t index_count = 0;
+  if (state.chunk_size != 0) {
+    // the chunk size tells the frame format the sender uses
+    const bool is_fd = state.chunk_size == mcan_transfer_chunk_size<T>(true);
+    index_count = mcan_transfer_fragment_count<T>(is_fd);
+  }
+  size_t first_missing = 0;
+  while (first_missing < index_count && state.received.test(first_missing)) {
+    ++first_missing;
+  }
+  uint16_t bitmap = 0;
+  if (index_count != 0 && first_missing == index_count) {
+    first_missing = MCAN_FLOW_CONTROL_COMPLETE;
+  } else {
+    for (size_t bit = 0; bit < 16 && first_missing + 1 + bit < index_count; ++bit) {
+      if (state.received.test(first_missing + 1 + bit)) {
+        bitmap |= static_cast<uint16_t>(1u << bit);
+      }
+    }
+  }
+  frame.size = 8;
+  frame.data[4] = static_cast<uint8_t>(first_missing & 0xFF);
+  frame.data[5] = static_cast<uint8_t>(first_missing >> 8);
+  frame.data[6] = static_cast<uint8_t>(bitmap & 0xFF);
+  frame.data[7] = static_cast<uint8_t>(bitmap >> 8);
+  return can_interface.send(frame);
+}
+
+/// @brief Send a multi frame message in blocks paced for a slow receiver.
+/// After every block of McanFlowControl::block_size fragments the receiver is asked for
+/// its status, the next block repeats only the fragments it reported missing before
+/// continuing with new ones. The receiver has to answer status requests, see
+/// mcan_is_flow_status_request() and mcan_send_flow_status().
+/// @return OK once the receiver reported the message complete, TimeOut if it stopped
+/// answering status requests or reported no new fragment for
+/// McanFlowControl::max_stalled_rounds blocks in a row.
+template<typename T>
+Status
+mcan_pack_send_msg_flow_controlled(CanBase& can_interface,
+                                   const T& struct_to_send,
+                                   uint8_t node_id,
+                                   McanFlowControl flow_control = {})
+{
+  static_assert(
+    std::is_member_pointer_v<decltype(&T::k_base_address)> || requires {
+      T::k_base_address;
+    }, "Type T must have k_base_address member or constant");
+  static_assert(sizeof(T::value) > 8, "Flow control is for multi frame messages");
+  static_assert(sizeof(T) <= MAX_STRUCT_SIZE, "Struct size too big to send over CAN");
+  const auto separation = std::chrono::microseconds(flow_control.separation_time_us);
+  const size_t block_size = std::max<size_t>(flow_control.block_size, 1);
+  detail::McanTransferEncoder<T> encoder(
+    struct_to_send,
+    mcan_connect_msg_id_with_node_id(T::k_base_address, node_id),
+    can_interface.supports_fd());
+  const size_t index_count = encoder.fragment_count();
+  // fragments the receiver reported and fragments sent at least once
+  std::bitset<CanMultiPackageFrame<T>::expected_index_count> acknowledged;
+  std::bitset<CanMultiPackageFrame<T>::expected_index_count> sent;
+  // fragments from here on were not reported by the last status
+  size_t reported_end = 0;
+  size_t stalled_rounds = 0;
+  CanFrame frame;
+  while (true) {
+    // fragments known to be missing and the ones never sent, in index order
+    size_t block = 0;
+    for (size_t i = 0; i < index_count && block < block_size; ++i) {
+      if (acknowledged.test(i) || (sent.test(i) && i >= reported_end)) {
+        continue;
+      }
+      encoder.encode(i, frame);
+      ARI_RETURN_ON_ERROR(can_interface.send(frame));
+      sent.set(i);
+      ++block;
+      if (separation.count() != 0) {
+        std::this_thread::sleep_for(separation);
+      }
+    }
+
+    // the request or the status may get lost as well, ask again before giving up
+    std::optional<Result<CanFrame>> response;
+    for (size_t attempt = 0; attempt <= flow_control.max_retries; ++attempt) {
+      response.emplace(can_interface.send_await_response(
+        detail::mcan_flow_control_frame(T::k_base_address,
+                                        node_id,
+                                        flow_control.sender_node_id,
+                                        detail::McanFlowControlKind::StatusRequest),
+        detail::mcan_flow_control_id(
+          node_id, flow_control.sender_node_id, detail::McanFlowControlKind::Status),
+        flow_control.status_timeout_ms));
+      if (response->ok() && response->valueOrDie().size >= 8 &&
+          detail::mcan_is_flow_control_frame(response->valueOrDie(),
+                                             T::k_base_address,
+                                             detail::McanFlowControlKind::Status)) {
+        break;
+      }
+      response.reset();
+    }
+    if (!response.has_value()) {
+      return Status::TimeOut(
+        "Receiver does not answer flow control status requests"_status);
+    }
+    const CanFrame& status = response->valueOrDie();
+    const size_t first_missing = status.data[4] | (status.data[5] << 8);
+    if (first_missing == MCAN_FLOW_CONTROL_COMPLETE) {
+      return Status::OK();
+    }
+    const auto bitmap = static_cast<uint16_t>(status.data[6] | (status.data[7] << 8));
+    const size_t acknowledged_before = acknowledged.count();
+    for (size_t i = 0; i < std::min(first_missing, index_count); ++i) {
+      acknowledged.set(i);
+    }
+    for (size_t bit = 0; bit < 16 && first_missing + 1 + bit < index_count; ++bit) {
+      if (bitmap & (1u << bit)) {
+        acknowledged.set(first_missing + 1 + bit);
+      }
+    }
+    reported_end = std::min(first_missing + 17, index_count);
+    if (acknowledged.count() > acknowledged_before) {
+      stalled_rounds = 0;
+    } else if (++stalled_rounds >= flow_control.max_stalled_rounds) {
+      return Status::TimeOut(
+        "Receiver makes no progress in a flow controlled transfer"_status);
+    }
+  }
+}
+
+} // namespace mcan
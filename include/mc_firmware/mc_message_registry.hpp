@@ -0,0 +1,255 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include "can_base.hpp"
+#include "mc_common.hpp"
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace mcan {
+
+namespace detail {
+
+struct McanRegistryEntry
+{
+  uint32_t base_address;
+  size_t index;
+};
+
+/// @brief Message of a MessageRegistry, with the reassembly state of multi frame
+/// messages.
+template<typename T, bool SingleFrame = MessageDescriptor<T>::single_frame>
+struct McanRegistrySlot
+{
+};
+
+template<typename T>
+struct McanRegistrySlot<T, false>
+{
+  T message{};
+  // the same fields as CanMultiPackageFrame, see mcan_unpack_into()
+  std::bitset<CanMultiPackageFrame<T>::expected_index_count> received;
+  size_t chunk_size = 0;
+  uint8_t generation = 0;
+  std::array<uint8_t, MCAN_TRANSFER_TRAILER_SIZE> trailer{};
+  // node the transfer being received comes from
+  uint8_t node_id = 0;
+};
+
+} // namespace detail
+
+/// @brief Receive side of a fixed set of message types, resolved at compile time.
+/// The k_base_address of every message goes into a sorted constexpr table, a frame is
+/// routed by a binary search over it and one indirect call through a constexpr table of
+/// the unpack functions, indexed by the message index. The frame is unpacked straight
+/// into the message and passed to a typed handler, without a virtual call or
+/// std::function in between. Registering two messages with the same
+/// k_base_address, or a message with a unique id reserved for flow control (see
+/// mcan_is_flow_control_uid()), does not compile (see
+/// tests/mc_message_registry_duplicate.cpp).
+///
+/// The handler is any callable accepting (uint8_t node_id, const Msg& message) for every
+/// registered Msg, e.g. a struct with one operator() per message.
+///
+/// @note Multi frame messages are reassembled in one buffer per message type, a
+/// fragment from another node restarts the transfer. Use McanReassembler for messages
+/// several nodes send at the same time.
+/// @note Not thread safe, feed it from one thread, attach() does so from the RX thread
+/// of the driver.
+template<typename... Msgs>
+class MessageRegistry
+{
+ public:
+  static constexpr size_t k_not_found = std::numeric_limits<size_t>::max();
+
+  /// @brief Registered messages sorted by k_base_address.
+  static constexpr auto k_table = [] {
+    size_t index = 0;
+    std::array<detail::McanRegistryEntry, sizeof...(Msgs)> table{
+      detail::McanRegistryEntry{ MessageDescriptor<Msgs>::base_address, index++ }...
+    };
+    std::sort(table.begin(), table.end(), [](const auto& a, const auto& b) {
+      return a.base_address < b.base_address;
+    });
+    return table;
+  }();
+
+  static_assert(sizeof...(Msgs) > 0, "Register at least one message");
+  static_assert(std::adjacent_find(k_table.begin(),
+                                   k_table.end(),
+                                   [](const auto& a, const auto& b) {
+                                     return a.base_address == b.base_address;
+                                   }) == k_table.end(),
+                "Two messages of the registry have the same k_base_address");
+  static_assert(std::all_of(k_table.begin(),
+                            k_table.end(),
+                            [](const auto& entry) {
+                              return entry.base_address <= 0x1FFFFF;
+                            }),
+                "k_base_address has to fit into 21 bits");
+  static_assert(std::none_of(k_table.begin(),
+                             k_table.end(),
+                             [](const auto& entry) {
+                               return mcan_is_flow_control_uid(entry.base_address);
+                             }),
+                "k_base_address is in the range reserved for flow control");
+
+  MessageRegistry() = default;
+  MessageRegistry(const MessageRegistry&) = delete;
+  MessageRegistry& operator=(const MessageRegistry&) = delete;
+
+  /// @brief Index of the message with the base address in Msgs, k_not_found if none.
+  static constexpr size_t index_of(uint32_t base_address)
+  {
+    auto entry = std::lower_bound(
+      k_table.begin(), k_table.end(), base_address, [](const auto& a, uint32_t b) {
+        return a.base_address < b;
+      });
+    if (entry == k_table.end() || entry->base_address != base_address) {
+      return k_not_found;
+    }
+    return entry->index;
+  }
+
+  static constexpr bool contains(uint32_t base_address)
+  {
+    return index_of(base_address) != k_not_found;
+  }
+
+  /// @brief Unpack the frame into the message its CAN ID names and pass the message to
+  /// the handler once it is complete.
+  /// @return OK when the handler was called, Cancelled while a multi frame message
+  /// waits for more fragments, KeyError for remote requests and frames of no
+  /// registered message, Invalid for malformed frames.
+  template<typename Handler>
+  Status dispatch(const CanFrame& frame, Handler&& handler)
+  {
+    if (frame.is_remote_request || (frame.id & CAN_REMOTE_REQUEST_FLAG) != 0) {
+      return Status::KeyError(
+        "Remote requests are not dispatched by the registry"_status);
+    }
+    const size_t index = index_of((frame.id >> 8) & 0x1FFFFF);
+    if (index == k_not_found) {
+      return Status::KeyError("No message registered for the CAN ID"_status);
+    }
+    return (this->*k_unpack<std::remove_reference_t<Handler>>[index])(frame, handler);
+  }
+
+  /// @brief Register one masked callback per message, each of them unpacks its message
+  /// without a lookup.
+  /// @note The registry and the handler have to outlive the registration, call
+  /// detach() first.
+  template<typename Handler>
+  Status attach(CanBase& can_interface, Handler& handler)
+  {
+    Status status = Status::OK();
+    [&]<size_t... Index>(std::index_sequence<Index...>) {
+      (void)((status = can_interface.add_callback_masked(
+                MessageDescriptor<Msgs>::base_address << 8,
+                k_id_mask,
+                CanBase::can_delegate_type(
+                  [this, &handler](CanBase&, const CanFrame& frame, void*) {
+                    (void)unpack<Index>(frame, handler);
+                  })),
+              status.ok()) &&
+             ...);
+    }(std::index_sequence_for<Msgs...>{});
+    if (!status.ok()) {
+      (void)detach(can_interface);
+    }
+    return status;
+  }
+
+  Status detach(CanBase& can_interface)
+  {
+    Status status = Status::OK();
+    (
+      [&] {
+        Status removed = can_interface.remove_callback_masked(
+          MessageDescriptor<Msgs>::base_address << 8, k_id_mask);
+        if (status.ok() && !removed.ok()) {
+          status = removed;
+        }
+      }(),
+      ...);
+    return status;
+  }
+
+ private:
+  // every node, data frames only
+  static constexpr uint32_t k_id_mask = 0x1FFFFF00 | CAN_REMOTE_REQUEST_FLAG;
+
+  template<typename Handler, size_t... Index>
+  static constexpr auto make_unpack_table(std::index_sequence<Index...>)
+  {
+    using Unpack = Status (MessageRegistry::*)(const CanFrame&, Handler&);
+    return std::array<Unpack, sizeof...(Index)>{
+      &MessageRegistry::unpack<Index, Handler>...
+    };
+  }
+
+  // jump table of dispatch(), unpack<Index> of every message indexed by Index
+  template<typename Handler>
+  static constexpr auto k_unpack =
+    make_unpack_table<Handler>(std::index_sequence_for<Msgs...>{});
+
+  template<size_t Index, typename Handler>
+  Status unpack(const CanFrame& frame, Handler& handler)
+  {
+    using T = std::tuple_element_t<Index, std::tuple<Msgs...>>;
+    static_assert(std::is_invocable_v<Handler&, uint8_t, const T&>,
+                  "Handler has to accept (uint8_t node_id, const Msg&) of every message");
+    const auto node_id = static_cast<uint8_t>(frame.id & 0xFF);
+    auto& slot = std::get<Index>(_slots);
+    if constexpr (MessageDescriptor<T>::single_frame) {
+      T message{};
+      ARI_RETURN_ON_ERROR(detail::mcan_unpack_into<T>(frame, message.value, slot));
+      handler(node_id, std::as_const(message));
+    } else {
+      if (slot.node_id != node_id) {
+        // a transfer of another node, start over
+        slot.received.reset();
+        slot.chunk_size = 0;
+        slot.node_id = node_id;
+      }
+      ARI_RETURN_ON_ERROR(detail::mcan_unpack_into<T>(frame, slot.message.value, slot));
+      handler(node_id, std::as_const(slot.message));
+    }
+    return Status::OK();
+  }
+
+  std::tuple<detail::McanRegistrySlot<Msgs>...> _slots;
+};
+
+} // namespace mcan
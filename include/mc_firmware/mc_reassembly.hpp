@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include "can_base.hpp"
+#include "inline_delegate.hpp"
+#include "mc_common.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace mcan {
+
+/// @brief Counters of McanReassembler.
+struct McanReassemblyStats
+{
+  /// @brief Messages delivered to the callback.
+  size_t completed = 0;
+  /// @brief Partial messages dropped because no fragment arrived within the timeout.
+  size_t timed_out = 0;
+  /// @brief Partial messages dropped to make room when every buffer was in use.
+  size_t evicted = 0;
+  /// @brief Partial messages dropped because of a malformed fragment.
+  size_t invalid = 0;
+};
+
+/// @brief Reassembles message T sent by many nodes at the same time, e.g. every node
+/// streaming the same telemetry struct. Fragments are routed by the node id of the CAN
+/// ID to a buffer of their own, so interleaved transfers do not disturb each other.
+/// Buffers come from a pool allocated once by the constructor and are handed out when
+/// the first fragment of a message arrives, memory is bounded by the pool size and no
+/// message allocates. A partial message is dropped if no fragment of it arrived within
+/// the timeout; when the pool runs out the least recently updated partial message makes
+/// room for the new one.
+/// @note on_frame(), expire() and the accessors are serialized by a mutex, so expire()
+/// may be called periodically from any thread while attach() feeds fragments from the
+/// RX thread of the driver. The callback runs with the mutex held and must not call
+/// back into the reassembler.
+template<typename T>
+class McanReassembler
+{
+ public:
+  using Type = typename CanMultiPackageFrame<T>::Type;
+  /// @brief Called with the node id and the message once all fragments arrived. The
+  /// message is only valid during the call.
+  using callback_type = InlineDelegate<void(uint8_t, const Type&)>;
+
+  /// @param buffer_count Messages that can be reassembled at the same time, at most 255.
+  /// @param timeout_ms Time a partial message may go without a new fragment.
+  McanReassembler(size_t buffer_count, uint32_t timeout_ms, callback_type callback)
+    : _timeout(std::chrono::milliseconds(timeout_ms))
+    , _callback(std::move(callback))
+    , _buffers(std::min<size_t>(buffer_count, k_nil))
+  {
+    _buffer_of_node.fill(k_nil);
+    for (size_t i = 0; i < _buffers.size(); ++i) {
+      _free.push_back(static_cast<uint8_t>(i));
+    }
+  }
+
+  McanReassembler(const McanReassembler&) = delete;
+  McanReassembler& operator=(const McanReassembler&) = delete;
+
+  /// @brief Register a masked callback for message T from any node.
+  /// @note The reassembler has to outlive the registration, call detach() first.
+  Status attach(CanBase& can_interface)
+  {
+    return can_interface.add_callback_masked(
+      k_id_base,
+      k_id_mask,
+      CanBase::can_delegate_type(
+        [this](CanBase&, const CanFrame& frame, void*) { (void)on_frame(frame); }));
+  }
+
+  Status detach(CanBase& can_interface)
+  {
+    return can_interface.remove_callback_masked(k_id_base, k_id_mask);
+  }
+
+  /// @brief Feed a received fragment of message T.
+  /// @return OK when the fragment completed a message, Cancelled while more fragments
+  /// are needed, Invalid for a frame of another message or a malformed fragment.
+  Status on_frame(const CanFrame& frame,
+                  std::chrono::steady_clock::time_point now =
+                    std::chrono::steady_clock::now())
+  {
+    if ((frame.id & k_id_mask) != k_id_base) {
+      return Status::Invalid("CAN frame does not belong to the message"_status);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    expire_locked(now);
+    const auto node_id = static_cast<uint8_t>(frame.id & 0xFF);
+    uint8_t index = _buffer_of_node[node_id];
+    if (index == k_nil) {
+      index = acquire(node_id);
+      if (index == k_nil) {
+        return Status::CapacityError("No reassembly buffers"_status);
+      }
+    } else {
+      // most recently updated buffers go to the back, the front is the oldest one
+      unlink(index);
+      link_back(index);
+    }
+    Buffer& buffer = _buffers[index];
+    buffer.last_update = now;
+    Status status = mcan_unpack_msg(frame, buffer.message);
+    if (status.ok()) {
+      ++_stats.completed;
+      _callback(node_id, buffer.message.value);
+      release(index);
+    } else if (status.status_code() != StatusCode::Cancelled) {
+      ++_stats.invalid;
+      release(index);
+    }
+    return status;
+  }
+
+  /// @brief Drop partial messages that did not get a fragment within the timeout.
+  /// Also done by every on_frame() call, call it periodically to free buffers of
+  /// transfers that stopped while the bus is quiet.
+  void expire(
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    expire_locked(now);
+  }
+
+  /// @brief Number of partial messages being reassembled.
+  size_t in_progress() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _buffers.size() - _free.size();
+  }
+
+  McanReassemblyStats stats() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+ private:
+  static constexpr uint8_t k_nil = std::numeric_limits<uint8_t>::max();
+  static constexpr uint32_t k_id_base =
+    mcan_connect_msg_id_with_node_id(T::k_base_address, 0);
+  // any node, remote requests are left out
+  static constexpr uint32_t k_id_mask = 0x1FFFFF00 | CAN_REMOTE_REQUEST_FLAG;
+
+  struct Buffer
+  {
+    CanMultiPackageFrame<T> message{};
+    std::chrono::steady_clock::time_point last_update;
+    uint8_t node_id = 0;
+    // list of buffers in use, ordered by last_update
+    uint8_t prev = k_nil;
+    uint8_t next = k_nil;
+  };
+
+  void expire_locked(std::chrono::steady_clock::time_point now)
+  {
+    while (_oldest != k_nil && now - _buffers[_oldest].last_update > _timeout) {
+      ++_stats.timed_out;
+      release(_oldest);
+    }
+  }
+
+  uint8_t acquire(uint8_t node_id)
+  {
+    if (_free.empty()) {
+      if (_oldest == k_nil) {
+        return k_nil;
+      }
+      ++_stats.evicted;
+      release(_oldest);
+    }
+    uint8_t index = _free.back();
+    _free.pop_back();
+    Buffer& buffer = _buffers[index];
+    buffer.message.received.reset();
+    buffer.message.chunk_size = 0;
+    buffer.node_id = node_id;
+    _buffer_of_node[node_id] = index;
+    link_back(index);
+    return index;
+  }
+
+  void release(uint8_t index)
+  {
+    unlink(index);
+    _buffer_of_node[_buffers[index].node_id] = k_nil;
+    _free.push_back(index);
+  }
+
+  void link_back(uint8_t index)
+  {
+    Buffer& buffer = _buffers[index];
+    buffer.prev = _newest;
+    buffer.next = k_nil;
+    if (_newest != k_nil) {
+      _buffers[_newest].next = index;
+    } else {
+      _oldest = index;
+    }
+    _newest = index;
+  }
+
+  void unlink(uint8_t index)
+  {
+    Buffer& buffer = _buffers[index];
+    if (buffer.prev != k_nil) {
+      _buffers[buffer.prev].next = buffer.next;
+    } else {
+      _oldest = buffer.next;
+    }
+    if (buffer.next != k_nil) {
+      _buffers[buffer.next].prev = buffer.prev;
+    } else {
+      _newest = buffer.prev;
+    }
+  }
+
+  mutable std::mutex _mutex;
+  std::chrono::steady_clock::duration _timeout;
+  callback_type _callback;
+  std::vector<Buffer> _buffers;
+  std::vector<uint8_t> _free;
+  std::array<uint8_t, 256> _buffer_of_node;
+  uint8_t _oldest = k_nil;
+  uint8_t _newest = k_nil;
+  McanReassemblyStats _stats;
+};
+
+} // namespace mcan
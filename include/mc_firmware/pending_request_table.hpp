@@ -0,0 +1,366 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include "can_base.hpp"
+#include "can_id_map.hpp"
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace mcan {
+
+/// @brief Table of requests waiting for a response frame, keyed by the expected CAN ID.
+/// Requests for the same ID are completed in FIFO order, requests for CAN_ANY_FRAME
+/// compete with them by age. Matching a frame is one CanIdMap lookup, insertion and
+/// removal are O(1) and timeouts are kept in a hierarchical timer wheel (6 levels of
+/// 64 slots with a tick of choice, e.g. 1 ms), so expiring requests costs O(1) per
+/// request instead of a timed wait or a scan per request.
+/// Time is passed in as ticks by the caller, the table never reads a clock.
+/// @note The table is not thread safe.
+template<typename Handler>
+class PendingRequestTable
+{
+ public:
+  static constexpr uint64_t k_no_expiry = std::numeric_limits<uint64_t>::max();
+  static constexpr uint64_t k_invalid_handle = std::numeric_limits<uint64_t>::max();
+
+  PendingRequestTable() { _slots.fill(k_nil); }
+
+  /// @brief Add a request.
+  /// @param deadline_tick Tick at which the request expires, should be after now_tick.
+  /// @param now_tick Current time, a deadline at or before it expires on the first
+  /// expire() call that advances past it.
+  /// @return handle for erase() or k_invalid_handle if requests wait for too many
+  /// distinct IDs (65535).
+  uint64_t insert(uint32_t response_id,
+                  uint64_t deadline_tick,
+                  uint64_t now_tick,
+                  Handler handler)
+  {
+    if (response_id != CAN_ANY_FRAME && _queues.find(response_id) == nullptr &&
+        !_queues.insert_or_assign(response_id, Queue{})) {
+      return k_invalid_handle;
+    }
+    if (_size == 0) {
+      // nothing to expire in between, jump straight to the present
+      _current_tick = now_tick;
+    }
+    uint32_t index = allocate();
+    Node& node = _nodes[index];
+    node.response_id = response_id;
+    node.sequence = _next_sequence++;
+    node.deadline_tick = deadline_tick;
+    node.handler = std::move(handler);
+    node.pending = true;
+    link_queue(index);
+    link_timer(index, _current_tick + 1);
+    ++_size;
+    return (static_cast<uint64_t>(node.generation) << 32) | index;
+  }
+
+  /// @brief Remove a request that is still pending.
+  /// @return false if the request was already completed or removed.
+  bool erase(uint64_t handle)
+  {
+    auto index = static_cast<uint32_t>(handle);
+    if (index >= _nodes.size() || !_nodes[index].pending ||
+        _nodes[index].generation != static_cast<uint32_t>(handle >> 32)) {
+      return false;
+    }
+    (void)release(index);
+    return true;
+  }
+
+  /// @brief Find the oldest request the frame with the ID answers, without removing it.
+  /// @return handle of the request or k_invalid_handle if there is none.
+  uint64_t find_match(uint32_t id) const
+  {
+    uint32_t index = k_nil;
+    if (const Queue* queue = _queues.find(id)) {
+      index = queue->head;
+    }
+    if (_any_queue.head != k_nil &&
+        (index == k_nil || _nodes[_any_queue.head].sequence < _nodes[index].sequence)) {
+      index = _any_queue.head;
+    }
+    if (index == k_nil) {
+      return k_invalid_handle;
+    }
+    return (static_cast<uint64_t>(_nodes[index].generation) << 32) | index;
+  }
+
+  /// @brief Handler of a pending request, the handle has to be valid.
+  Handler& handler(uint64_t handle)
+  {
+    return _nodes[static_cast<uint32_t>(handle)].handler;
+  }
+
+  /// @brief Remove a pending request, the handle has to be valid.
+  Handler take(uint64_t handle) { return release(static_cast<uint32_t>(handle)); }
+
+  /// @brief Remove the oldest request the frame with the ID answers.
+  /// @return false if there is none.
+  bool take_match(uint32_t id, Handler& handler)
+  {
+    uint64_t handle = find_match(id);
+    if (handle == k_invalid_handle) {
+      return false;
+    }
+    handler = take(handle);
+    return true;
+  }
+
+  /// @brief Advance the wheel to now_tick and remove every request due by then.
+  /// @param f Called as f(Handler&&) for every expired request, in deadline order.
+  template<typename F>
+  void expire(uint64_t now_tick, F&& f)
+  {
+    while (_current_tick < now_tick) {
+      if (_size == 0) {
+        _current_tick = now_tick;
+        break;
+      }
+      uint64_t tick = _current_tick + 1;
+      // move the requests of every level that wraps at this tick one level closer
+      for (int level = k_levels - 1; level > 0; --level) {
+        if ((tick & ((uint64_t{ 1 } << (k_slot_bits * level)) - 1)) == 0) {
+          cascade(level, tick);
+        }
+      }
+      uint32_t& slot = _slots[slot_index(0, tick)];
+      while (slot != k_nil) {
+        f(release(slot));
+      }
+      _current_tick = tick;
+    }
+  }
+
+  /// @brief Remove every request.
+  /// @param f Called as f(Handler&&) for every request.
+  template<typename F>
+  void take_all(F&& f)
+  {
+    for (uint32_t index = 0; index < _nodes.size(); ++index) {
+      if (_nodes[index].pending) {
+        f(release(index));
+      }
+    }
+  }
+
+  /// @brief Tick at which expire() has to be called next, k_no_expiry if the table is
+  /// empty. The wheel only knows the exact slot of requests due within the current
+  /// block of 64 ticks, otherwise the start of the next block is returned, where the
+  /// higher levels cascade.
+  uint64_t next_expiry_tick() const
+  {
+    if (_size == 0) {
+      return k_no_expiry;
+    }
+    uint64_t tick = _current_tick + 1;
+    while ((tick & k_slot_mask) != 0) {
+      if (_slots[tick & k_slot_mask] != k_nil) {
+        return tick;
+      }
+      ++tick;
+    }
+    return tick;
+  }
+
+  /// @brief Call f(response_id) for every distinct ID requests wait for.
+  template<typename F>
+  void for_each_response_id(F&& f) const
+  {
+    _queues.for_each([&](uint32_t id, const Queue&) { f(id); });
+    if (_any_queue.head != k_nil) {
+      f(CAN_ANY_FRAME);
+    }
+  }
+
+  size_t size() const { return _size; }
+
+  bool empty() const { return _size == 0; }
+
+ private:
+  static constexpr uint32_t k_nil = std::numeric_limits<uint32_t>::max();
+  static constexpr int k_levels = 6;
+  static constexpr int k_slot_bits = 6;
+  static constexpr uint64_t k_slot_mask = (1 << k_slot_bits) - 1;
+
+  struct Queue
+  {
+    uint32_t head = k_nil;
+    uint32_t tail = k_nil;
+  };
+
+  struct Node
+  {
+    Handler handler;
+    uint64_t sequence = 0;
+    uint64_t deadline_tick = 0;
+    uint32_t response_id = 0;
+    uint32_t generation = 0;
+    // FIFO of requests for the same ID
+    uint32_t queue_prev = k_nil;
+    uint32_t queue_next = k_nil;
+    // list of requests in the same wheel slot
+    uint32_t timer_prev = k_nil;
+    uint32_t timer_next = k_nil;
+    uint32_t timer_slot = 0;
+    bool pending = false;
+  };
+
+  uint32_t allocate()
+  {
+    if (!_free_nodes.empty()) {
+      uint32_t index = _free_nodes.back();
+      _free_nodes.pop_back();
+      return index;
+    }
+    _nodes.emplace_back();
+    return static_cast<uint32_t>(_nodes.size() - 1);
+  }
+
+  Handler release(uint32_t index)
+  {
+    Node& node = _nodes[index];
+    unlink_queue(index);
+    unlink_timer(index);
+    node.pending = false;
+    ++node.generation;
+    --_size;
+    _free_nodes.push_back(index);
+    return std::move(node.handler);
+  }
+
+  void link_queue(uint32_t index)
+  {
+    Node& node = _nodes[index];
+    // the queue of the ID was created by insert()
+    Queue* queue =
+      node.response_id == CAN_ANY_FRAME ? &_any_queue : _queues.find(node.response_id);
+    node.queue_prev = queue->tail;
+    node.queue_next = k_nil;
+    if (queue->tail != k_nil) {
+      _nodes[queue->tail].queue_next = index;
+    } else {
+      queue->head = index;
+    }
+    queue->tail = index;
+  }
+
+  void unlink_queue(uint32_t index)
+  {
+    Node& node = _nodes[index];
+    Queue* queue =
+      node.response_id == CAN_ANY_FRAME ? &_any_queue : _queues.find(node.response_id);
+    if (node.queue_prev != k_nil) {
+      _nodes[node.queue_prev].queue_next = node.queue_next;
+    } else {
+      queue->head = node.queue_next;
+    }
+    if (node.queue_next != k_nil) {
+      _nodes[node.queue_next].queue_prev = node.queue_prev;
+    } else {
+      queue->tail = node.queue_prev;
+    }
+    if (queue->head == k_nil && queue != &_any_queue) {
+      _queues.erase(node.response_id);
+    }
+  }
+
+  /// @brief Put the request into the wheel, relative to the first tick not processed
+  /// yet. The level is the highest 6 bit group in which the deadline differs from it,
+  /// so the slot is reached (and cascaded down) exactly when the deadline gets close.
+  void link_timer(uint32_t index, uint64_t reference_tick)
+  {
+    Node& node = _nodes[index];
+    uint64_t deadline = std::max(node.deadline_tick, reference_tick);
+    uint64_t difference = deadline ^ reference_tick;
+    int level = difference == 0 ? 0 : (std::bit_width(difference) - 1) / k_slot_bits;
+    if (level >= k_levels) {
+      // further than the wheel reaches (about 2 years at 1 ms), park it in the last level
+      level = k_levels - 1;
+    }
+    uint32_t slot = slot_index(level, deadline);
+    node.timer_slot = slot;
+    node.timer_prev = k_nil;
+    node.timer_next = _slots[slot];
+    if (_slots[slot] != k_nil) {
+      _nodes[_slots[slot]].timer_prev = index;
+    }
+    _slots[slot] = index;
+  }
+
+  void unlink_timer(uint32_t index)
+  {
+    Node& node = _nodes[index];
+    if (node.timer_prev != k_nil) {
+      _nodes[node.timer_prev].timer_next = node.timer_next;
+    } else {
+      _slots[node.timer_slot] = node.timer_next;
+    }
+    if (node.timer_next != k_nil) {
+      _nodes[node.timer_next].timer_prev = node.timer_prev;
+    }
+  }
+
+  static uint32_t slot_index(int level, uint64_t tick)
+  {
+    return static_cast<uint32_t>(level * (k_slot_mask + 1) +
+                                 ((tick >> (k_slot_bits * level)) & k_slot_mask));
+  }
+
+  void cascade(int level, uint64_t tick)
+  {
+    uint32_t& slot = _slots[slot_index(level, tick)];
+    uint32_t index = slot;
+    slot = k_nil;
+    while (index != k_nil) {
+      uint32_t next = _nodes[index].timer_next;
+      link_timer(index, tick);
+      index = next;
+    }
+  }
+
+  std::vector<Node> _nodes;
+  std::vector<uint32_t> _free_nodes;
+  size_t _size = 0;
+  uint64_t _next_sequence = 0;
+
+  CanIdMap<Queue> _queues;
+  Queue _any_queue;
+
+  // last tick processed by expire()
+  uint64_t _current_tick = 0;
+  std::array<uint32_t, k_levels * (k_slot_mask + 1)> _slots;
+};
+
+} // namespace mcan
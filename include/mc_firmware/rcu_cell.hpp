@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mcan {
+
+namespace detail {
+
+/// @brief A read section of the calling thread, linked to the one it is nested in.
+struct RcuReadSection
+{
+  const void* cell;
+  const RcuReadSection* outer;
+};
+
+/// @brief Innermost RcuCell read section of the calling thread, nullptr outside of any.
+inline thread_local const RcuReadSection* rcu_read_sections = nullptr;
+
+/// @brief True if the calling thread is inside a read section of the cell.
+inline bool
+rcu_reading(const void* cell)
+{
+  for (const RcuReadSection* section = rcu_read_sections; section != nullptr;
+       section = section->outer) {
+    if (section->cell == cell) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace detail
+
+/// @brief Read-copy-update cell holding one published version of T.
+/// Readers enter a read section and get a stable snapshot, this costs two atomic
+/// increments and never blocks or waits, no matter what writers do. Writers copy the
+/// current version, modify the copy and publish it with a pointer swap, then wait for a
+/// grace period (every reader that could still see the old version has left its read
+/// section) before destroying the old version.
+/// Grace periods use two reader counters selected by the epoch parity: new readers
+/// enter the counter of the current epoch, the writer flips the epoch and waits for the
+/// counter of the previous one to drain, so a steady stream of readers can not starve
+/// it.
+/// A writer running inside a read section of the same cell (e.g. a callback removing
+/// itself) can not wait for its own section to end, its old version is retired and
+/// destroyed by a later update or by the destructor instead. Read sections are tracked
+/// per cell, a writer inside a read section of another cell waits as usual.
+/// A writer waiting for a grace period yields first and then sleeps with an exponential
+/// backoff up to k_max_grace_sleep, so a long read section does not keep a core busy.
+/// @note Writers are serialized by a mutex, readers are wait free.
+template<typename T>
+class RcuCell
+{
+ public:
+  /// @brief RAII read section, the snapshot stays valid until the guard is destroyed.
+  class ReadGuard
+  {
+   public:
+    explicit ReadGuard(const RcuCell& cell)
+      : _counter(&cell._readers[cell._epoch.load() & 1])
+      , _section{ &cell, detail::rcu_read_sections }
+    {
+      _counter->fetch_add(1);
+      detail::rcu_read_sections = &_section;
+      // loaded after the counter increment, a writer that swapped the pointer before
+      // the increment became visible sees the counter and waits for us
+      _value = cell._current.load();
+    }
+
+    /// @note Guards have to be destroyed in reverse order of their creation on each
+    /// thread, which the scope of a local guard ensures.
+    ~ReadGuard()
+    {
+      detail::rcu_read_sections = _section.outer;
+      _counter->fetch_sub(1, std::memory_order_release);
+    }
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    const T& operator*() const { return *_value; }
+    const T* operator->() const { return _value; }
+
+   private:
+    std::atomic<uint64_t>* _counter;
+    detail::RcuReadSection _section;
+    const T* _value;
+  };
+
+  /// @brief Longest sleep between two checks of a grace period.
+  static constexpr std::chrono::microseconds k_max_grace_sleep{ 1000 };
+
+  RcuCell()
+    : _current(new T())
+  {
+  }
+
+  ~RcuCell()
+  {
+    delete _current.load();
+    for (T* retired : _retired) {
+      delete retired;
+    }
+  }
+
+  RcuCell(const RcuCell&) = delete;
+  RcuCell& operator=(const RcuCell&) = delete;
+
+  /// @brief Enter a read section.
+  ReadGuard read() const { return ReadGuard(*this); }
+
+  /// @brief Publish a modified copy of the current version.
+  /// @param modify Called as modify(T& copy), returns false to discard the copy and
+  /// keep the current version.
+  /// @return result of modify.
+  template<typename F>
+  bool update(F&& modify)
+  {
+    T* old;
+    std::vector<T*> reclaim;
+    {
+      std::lock_guard<std::mutex> lock(_writer_mutex);
+      auto next = std::make_unique<T>(*_current.load());
+      if (!modify(*next)) {
+        return false;
+      }
+      old = _current.exchange(next.release());
+      if (detail::rcu_reading(this)) {
+        _retired.push_back(old);
+        return true;
+      }
+      // everything retired so far was replaced before the grace period below starts
+      reclaim.swap(_retired);
+    }
+    // waiting happens outside of _writer_mutex, a reader that updates the cell from
+    // inside its read section must never block on a writer that waits for it
+    synchronize();
+    delete old;
+    for (T* retired : reclaim) {
+      delete retired;
+    }
+    return true;
+  }
+
+ private:
+  void synchronize()
+  {
+    std::lock_guard<std::mutex> lock(_grace_mutex);
+    // two flips: a reader may have picked its counter just before the first flip
+    for (int flip = 0; flip < 2; ++flip) {
+      uint64_t epoch = _epoch.fetch_add(1);
+      std::chrono::microseconds sleep{ 1 };
+      for (int spins = 0; _readers[epoch & 1].load() != 0; ++spins) {
+        // read sections are short, most grace periods end within a few yields
+        if (spins < 64) {
+          std::this_thread::yield();
+        } else {
+          std::this_thread::sleep_for(sleep);
+          sleep = std::min(sleep * 2, k_max_grace_sleep);
+        }
+      }
+    }
+  }
+
+  std::atomic<T*> _current;
+  mutable std::atomic<uint64_t> _epoch{ 0 };
+  mutable std::atomic<uint64_t> _readers[2]{};
+  std::mutex _writer_mutex;
+  // serializes grace periods so the epoch flips of one writer are consecutive
+  std::mutex _grace_mutex;
+  // old versions that could not be reclaimed because the writer was inside a read
+  // section
+  std::vector<T*> _retired;
+};
+
+} // namespace mcan
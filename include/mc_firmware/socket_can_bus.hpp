@@ -0,0 +1,318 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#pragma once
+
+#include "can_base.hpp"
+#include "can_id_map.hpp"
+#include "io_uring_loop.hpp"
+#include "masked_id_matcher.hpp"
+#include "pending_request_table.hpp"
+#include "rcu_cell.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mcan {
+
+/// @brief Configuration of the SocketCAN driver.
+struct SocketCanConfig
+{
+  /// @brief Name of the network interface, e.g. "can0" or "vcan0".
+  std::string interface_name = "can0";
+
+  /// @brief Number of frames that can wait in the user space TX queue.
+  /// send() returns CapacityError when the queue is full.
+  size_t tx_queue_capacity = 4096;
+
+  /// @brief Size of the kernel socket receive buffer in bytes, 0 keeps the system
+  /// default. A large buffer lets the RX thread survive scheduling hiccups at full bus
+  /// load without the kernel dropping frames.
+  int rx_socket_buffer_size = 1 << 20;
+
+  /// @brief Maximum number of frames moved between the kernel and user space in one
+  /// recvmmsg/sendmmsg call. Received frames are dispatched to callbacks as one batch.
+  /// Use 1 to get the one-frame-per-syscall behaviour.
+  size_t io_batch_size = 64;
+
+  /// @brief Shared io_uring loop to run the bus I/O on instead of the bus own RX/TX
+  /// threads. If the loop can not serve the socket the bus falls back to epoll threads.
+  std::shared_ptr<IoUringLoop> io_uring_loop;
+
+  /// @brief Install a kernel CAN_RAW_FILTER built from the registered callbacks and
+  /// pending send_await_response() calls, so frames nobody listens for are dropped by
+  /// the kernel instead of waking up the RX side. If there are more filters than the
+  /// kernel accepts, similar ones are merged, which may let some unwanted frames through
+  /// but never drops a wanted one. Response IDs of completed requests stay accepted
+  /// until the filter is rebuilt, so a request whose ID is accepted already costs no
+  /// setsockopt().
+  bool kernel_filtering = true;
+
+  /// @brief Send and receive CAN FD frames if the interface is configured for CAN FD
+  /// (e.g. "ip link set can0 type can ... fd on"), see SocketCanBus::supports_fd().
+  bool enable_fd = true;
+
+  /// @brief Called with an IOError when receiving starts failing, e.g. with ENETDOWN
+  /// while the interface is bounced, and again only after a successful receive. The RX
+  /// side keeps running and retries with a back off, timeouts of pending requests keep
+  /// firing meanwhile. Called from the RX thread (or the io_uring loop).
+  std::function<void(const Status&)> rx_error_handler;
+};
+
+/// @brief Linux SocketCAN implementation of the CanBase interface.
+/// open_can() starts two threads, one for RX and one for TX. Both of them sleep in
+/// epoll and are woken up by the socket or by eventfd notifications, so no thread ever
+/// polls the bus. Callbacks are called from the RX thread.
+/// If SocketCanConfig::io_uring_loop is set the I/O runs on the loop thread instead and
+/// callbacks are called from there.
+/// Callbacks can be added and removed at any time without ever blocking dispatch, which
+/// works on a snapshot of the registered callbacks. Once remove_callback() returns the
+/// removed callback is neither running nor called again, except when it is removed from
+/// inside a callback, then the running dispatch may still finish with it.
+class SocketCanBus : public CanBase
+{
+ public:
+  explicit SocketCanBus(SocketCanConfig config);
+  explicit SocketCanBus(const std::string& interface_name);
+  ~SocketCanBus() override;
+
+  SocketCanBus(const SocketCanBus&) = delete;
+  SocketCanBus& operator=(const SocketCanBus&) = delete;
+
+  /// @brief Queue a frame for the TX thread.
+  /// @return Invalid for a classic frame of more than 8 bytes or a CAN FD frame of more
+  /// than 64 bytes, nothing is sent then.
+  /// @note Does not block, returns CapacityError if the TX queue is full.
+  Status send(const CanFrame& frame) override;
+
+  Result<CanFrame> send_await_response(const CanFrame& frame,
+                                       uint32_t response_id,
+                                       uint32_t timeout_ms = 1000) override;
+
+  /// @note Handlers are called from the RX thread (or the io_uring loop), timeouts are
+  /// driven by a timerfd polled by the same thread.
+  Status send_await_response_async(const CanFrame& frame,
+                                   uint32_t response_id,
+                                   uint32_t timeout_ms,
+                                   response_handler_type handler) override;
+
+  Status send_await_response_stream_async(const CanFrame& frame,
+                                          uint32_t response_id,
+                                          uint32_t timeout_ms,
+                                          response_stream_handler_type handler) override;
+
+  Status add_callback(uint32_t id,
+                      can_callback_type callback,
+                      void* args = nullptr) override;
+
+  Status add_callback(uint32_t id,
+                      can_delegate_type callback,
+                      void* args = nullptr) override;
+
+  /// @note Unlike the CanBase contract the priority of masked callbacks is
+  /// deterministic: the one with the most bits set in the mask is called.
+  /// @note Every received frame without an exact callback probes one table per distinct
+  /// mask, about 2 ns each, however many callbacks share a mask. Keep to a handful of
+  /// distinct masks: 32 of them already cost about 55 ns per frame.
+  Status add_callback_masked(uint32_t id_base,
+                             uint32_t id_mask,
+                             can_callback_type callback,
+                             void* args = nullptr) override;
+
+  Status add_callback_masked(uint32_t id_base,
+                             uint32_t id_mask,
+                             can_delegate_type callback,
+                             void* args = nullptr) override;
+
+  Status remove_callback(uint32_t id) override;
+
+  Status remove_callback_masked(uint32_t id_base, uint32_t id_mask) override;
+
+  /// @brief True once open_can() enabled CAN FD frames on the socket.
+  bool supports_fd() const override;
+
+  Status open_can() override;
+
+  /// @brief Run the bus on a socket the caller opened and bound, e.g. one handed over
+  /// by a privileged process, instead of opening SocketCanConfig::interface_name.
+  /// The socket only has to carry one struct can_frame or canfd_frame per datagram, CAN
+  /// FD frames are used if the caller enabled CAN_RAW_FD_FRAMES on it.
+  /// @note The bus takes ownership of the socket, it is closed by close_can() or right
+  /// away if this call fails.
+  Status open_can(int socket_fd);
+
+  /// @brief Stop the I/O, cancel pending requests and close the socket.
+  /// @return Invalid if called from a callback or response handler, the thread running
+  /// them can not wait for itself to stop, close the bus from another thread instead.
+  Status close_can() override;
+
+ private:
+  friend class IoUringLoop;
+
+  struct CallbackEntry
+  {
+    can_delegate_type callback;
+    void* args;
+  };
+
+  struct CallbackTable
+  {
+    CanIdMap<CallbackEntry> exact;
+    MaskedIdMatcher<CallbackEntry> masked;
+  };
+
+  struct IoBatch;
+
+  // exactly one of the handlers is set
+  struct PendingHandler
+  {
+    response_handler_type once;
+    response_stream_handler_type stream;
+  };
+
+  // ticks of the table are milliseconds of steady_clock
+  using PendingTable = PendingRequestTable<PendingHandler>;
+
+  struct CompletedRequest
+  {
+    PendingHandler handler;
+    Result<CanFrame> result;
+    // stream requests stay in the table until their handler returns false
+    uint64_t stream_handle = PendingTable::k_invalid_handle;
+  };
+
+  struct KernelFilter
+  {
+    uint32_t id;
+    uint32_t mask;
+
+    bool operator==(const KernelFilter&) const = default;
+  };
+
+  Status check_config() const;
+  /// @brief Start the I/O on _socket_fd, shared by both open_can() overloads.
+  Status start_io();
+  Status start_threads();
+  void rx_loop();
+  void tx_loop();
+  /// @return 0 when the socket was drained, otherwise errno that stopped the reads.
+  int read_frames();
+  /// @brief Pass the receive error to SocketCanConfig::rx_error_handler.
+  void report_rx_error(int error);
+  /// @return 0 when the TX queue was drained, otherwise errno that stopped the writes.
+  int write_frames();
+  void dispatch(const CanFrame* frames, size_t count);
+  /// @brief Complete the pending requests the frames answer.
+  void match_requests(const CanFrame* frames, size_t count);
+  void close_fds();
+  /// @brief Register the request and send the frame, see send_await_response_async().
+  Status submit_request(const CanFrame& frame,
+                        uint32_t response_id,
+                        uint32_t timeout_ms,
+                        PendingHandler handler);
+  /// @brief Complete requests whose deadline passed, called when the timerfd fires.
+  void expire_requests();
+  /// @brief Complete every pending request with the status.
+  void cancel_requests(const Status& status);
+  static uint64_t request_tick_now();
+  /// @brief Arm the timerfd for the tick, requires _pending_mutex.
+  void arm_request_timer(uint64_t tick);
+  /// @brief Call the handlers of _completed_requests and clear it.
+  void run_completed_requests();
+  /// @brief Collect the callback IDs and rebuild the kernel filter, a no-op if kernel
+  /// filtering is disabled.
+  void update_kernel_filter();
+  /// @brief Make the kernel filter accept the response ID of a new request. Nothing is
+  /// done if the installed filter covers it already, otherwise the ID is appended and
+  /// the filter is rebuilt only when it has no room left. IDs of completed requests are
+  /// dropped by the next rebuild.
+  void widen_kernel_filter(uint32_t response_id);
+  /// @brief Build the filter from _callback_filters and the pending requests and
+  /// install it, requires _filter_mutex.
+  void rebuild_kernel_filter();
+  /// @brief Install the filter unless it is installed already, requires _filter_mutex.
+  void install_kernel_filter(std::vector<KernelFilter>&& filters);
+
+  /// @brief Pop up to max_count frames from the TX queue, used by the io_uring loop.
+  size_t take_tx_frames(CanFrame* frames, size_t max_count);
+
+  SocketCanConfig _config;
+  int _socket_fd = -1;
+  int _rx_epoll_fd = -1;
+  int _tx_epoll_fd = -1;
+  int _tx_event_fd = -1;
+  int _stop_event_fd = -1;
+  int _timer_fd = -1;
+  std::atomic<bool> _running{ false };
+  bool _fd_enabled = false;
+  std::thread _rx_thread;
+  std::thread _tx_thread;
+  // set while the bus is attached to an io_uring loop instead of running own threads,
+  // guarded by _tx_mutex
+  std::shared_ptr<IoUringLoop> _io_uring_loop;
+  // only touched by the RX and TX thread respectively
+  std::unique_ptr<IoBatch> _rx_batch;
+  std::unique_ptr<IoBatch> _tx_batch;
+
+  // ring buffer of frames waiting for the TX thread, the lock also keeps _tx_event_fd
+  // open while send() signals it
+  std::mutex _tx_mutex;
+  std::vector<CanFrame> _tx_queue;
+  size_t _tx_head = 0;
+  size_t _tx_count = 0;
+
+  // dispatch reads a snapshot without locking, add/remove publish a new version
+  RcuCell<CallbackTable> _callbacks;
+
+  // requests waiting for a response
+  std::mutex _pending_mutex;
+  PendingTable _pending;
+  // tick the timerfd is armed for, k_no_expiry when it is disarmed
+  uint64_t _timer_tick = PendingTable::k_no_expiry;
+  // lets dispatch skip _pending_mutex when no request is pending
+  std::atomic<size_t> _pending_count{ 0 };
+  // handlers to call once _pending_mutex is released, only touched by the RX side
+  std::vector<CompletedRequest> _completed_requests;
+  // streams whose handler returned false while run_completed_requests() runs
+  std::vector<uint64_t> _finished_streams;
+  // frames a stream matched after its handler returned false, dispatch() matches them
+  // again for the next request waiting for their ID
+  std::vector<CanFrame> _unclaimed_frames;
+  std::vector<CanFrame> _rematched_frames;
+
+  // serializes filter updates and guards the socket against being closed meanwhile,
+  // locked before _pending_mutex and _tx_mutex
+  std::mutex _filter_mutex;
+  std::vector<KernelFilter> _callback_filters;
+  std::vector<KernelFilter> _kernel_filter;
+  bool _kernel_filter_installed = false;
+};
+
+} // namespace mcan
@@ -25,8 +25,17 @@ SOFTWARE.
  */
 
 #pragma once
-#include <optional>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 
 /**
  * @file status.hpp
@@ -162,6 +171,81 @@ enum class StatusCode : char
   TimeOut = 46,
 };
 
+/**
+ * @brief A string literal used as a Status message, see operator""_status.
+ *
+ * The constructor is consteval, the pointer has to be a constant expression, so it always
+ * points to text with static storage duration and a Status can refer to it by pointer.
+ */
+class StatusLiteral
+{
+ public:
+  consteval explicit StatusLiteral(const char* text)
+    : _text(text != nullptr ? text : "")
+  {
+  }
+
+ private:
+  friend class StatusMessage;
+
+  const char* _text;
+};
+
+inline namespace literals {
+
+/// @brief Status message stored by pointer, e.g. Status::Invalid("Bad frame"_status).
+/// @note Outside of namespace mcan it is made visible by using namespace mcan::literals.
+consteval StatusLiteral
+operator""_status(const char* text, size_t)
+{
+  return StatusLiteral(text);
+}
+
+} // namespace literals
+
+/**
+ * @brief Message of an error Status, see the Status factories.
+ *
+ * - A StatusLiteral (e.g. "Bad frame"_status) is stored by pointer, the Status only
+ *   refers to it.
+ * - Any other text, a const char*, a std::string_view or a formatted std::string, is
+ *   interned: equal messages share one copy, made the first time the message is seen.
+ */
+class StatusMessage
+{
+ public:
+  StatusMessage(StatusLiteral literal)
+    : _literal(literal._text)
+  {
+  }
+
+  StatusMessage(const char* message)
+    : _view(message != nullptr ? message : "")
+  {
+  }
+
+  StatusMessage(std::string_view message)
+    : _view(message)
+  {
+  }
+
+  StatusMessage(std::string&& message)
+    : _message(std::move(message))
+    , _formatted(true)
+  {
+  }
+
+ private:
+  friend class Status;
+
+  std::string_view text() const { return _formatted ? _message : _view; }
+
+  const char* _literal = nullptr;
+  std::string_view _view;
+  std::string _message;
+  bool _formatted = false;
+};
+
 /**
  * @brief Status class used as return type.
  *
@@ -169,175 +253,538 @@ enum class StatusCode : char
  * code and a message. For easy use, there are static methods for creating common statuses
  * with some messages. The Status can be converted to a Result object that contains the
  * status and the value.
+ *
+ * A Status is a single pointer to an immutable, interned state, nullptr for OK, so it
+ * is trivially copyable and copying or checking it never allocates. All statuses with
+ * the same code and message share one state:
+ * - string literals ("..."_status) are looked up by address in a lock free table,
+ *   creating such a Status allocates only the first time the literal is seen;
+ * - any other message is looked up by its text, it costs a hash and a short lock, and
+ *   one allocation the first time the text is seen.
+ *
+ * @note States are never freed, every distinct message text stays in memory until the
+ * process exits. Keep values that change with every call (counters, timestamps) out of
+ * error messages, each of them would add another state.
  */
 class Status
 {
  public:
-  Status(const Status& status) = default;
+  Status() noexcept = default;
 
-  [[nodiscard]] static Status OK() { return Status(StatusCode::OK, "", "OK"); };
+  [[nodiscard]] static Status OK() noexcept { return Status(); };
 
-  [[nodiscard]] static Status OK(std::string&& msg)
+  [[nodiscard]] static Status OK(StatusMessage msg)
   {
-    return Status(StatusCode::OK, std::move(msg), "OK|");
+    return Status(StatusCode::OK, std::move(msg));
   };
 
-  [[nodiscard]] static Status OutOfMemory(std::string&& msg)
+  [[nodiscard]] static Status OutOfMemory(StatusMessage msg)
   {
-    return Status(StatusCode::OutOfMemory, std::move(msg), "OutOfMemory|");
+    return Status(StatusCode::OutOfMemory, std::move(msg));
   };
 
-  [[nodiscard]] static Status KeyError(std::string&& msg)
+  [[nodiscard]] static Status KeyError(StatusMessage msg)
   {
-    return Status(StatusCode::KeyError, std::move(msg), "KeyError|");
+    return Status(StatusCode::KeyError, std::move(msg));
   };
 
-  [[nodiscard]] static Status TypeError(std::string&& msg)
+  [[nodiscard]] static Status TypeError(StatusMessage msg)
   {
-    return Status(StatusCode::TypeError, std::move(msg), "TypeError|");
+    return Status(StatusCode::TypeError, std::move(msg));
   };
 
-  [[nodiscard]] static Status Invalid(std::string&& msg)
+  [[nodiscard]] static Status Invalid(StatusMessage msg)
   {
-    return Status(StatusCode::Invalid, std::move(msg), "Invalid|");
+    return Status(StatusCode::Invalid, std::move(msg));
   };
 
-  [[nodiscard]] static Status IOError(std::string&& msg)
+  [[nodiscard]] static Status IOError(StatusMessage msg)
   {
-    return Status(StatusCode::IOError, std::move(msg), "IOError|");
+    return Status(StatusCode::IOError, std::move(msg));
   };
 
-  [[nodiscard]] static Status CapacityError(std::string&& msg)
+  [[nodiscard]] static Status CapacityError(StatusMessage msg)
   {
-    return Status(StatusCode::CapacityError, std::move(msg), "CapacityError|");
+    return Status(StatusCode::CapacityError, std::move(msg));
   };
 
-  [[nodiscard]] static Status IndexError(std::string&& msg)
+  [[nodiscard]] static Status IndexError(StatusMessage msg)
   {
-    return Status(StatusCode::IndexError, std::move(msg), "IndexError|");
+    return Status(StatusCode::IndexError, std::move(msg));
   };
 
-  [[nodiscard]] static Status Cancelled(std::string&& msg)
+  [[nodiscard]] static Status Cancelled(StatusMessage msg)
   {
-    return Status(StatusCode::Cancelled, std::move(msg), "Cancelled|");
+    return Status(StatusCode::Cancelled, std::move(msg));
   };
 
-  [[nodiscard]] static Status UnknownError(std::string&& msg)
+  [[nodiscard]] static Status UnknownError(StatusMessage msg)
   {
-    return Status(StatusCode::UnknownError, std::move(msg), "UnknownError|");
+    return Status(StatusCode::UnknownError, std::move(msg));
   };
 
-  [[nodiscard]] static Status NotImplemented(std::string&& msg)
+  [[nodiscard]] static Status NotImplemented(StatusMessage msg)
   {
-    return Status(StatusCode::NotImplemented, std::move(msg), "NotImplemented|");
+    return Status(StatusCode::NotImplemented, std::move(msg));
   };
 
-  [[nodiscard]] static Status SerializationError(std::string&& msg)
+  [[nodiscard]] static Status SerializationError(StatusMessage msg)
   {
-    return Status(StatusCode::SerializationError, std::move(msg), "SerializationError|");
+    return Status(StatusCode::SerializationError, std::move(msg));
   };
 
-  [[nodiscard]] static Status RError(std::string&& msg)
+  [[nodiscard]] static Status RError(StatusMessage msg)
   {
-    return Status(StatusCode::RError, std::move(msg), "RError|");
+    return Status(StatusCode::RError, std::move(msg));
   };
 
-  [[nodiscard]] static Status CodeGenError(std::string&& msg)
+  [[nodiscard]] static Status CodeGenError(StatusMessage msg)
   {
-    return Status(StatusCode::CodeGenError, std::move(msg), "CodeGenError|");
+    return Status(StatusCode::CodeGenError, std::move(msg));
   };
 
-  [[nodiscard]] static Status ExpressionValidationError(std::string&& msg)
+  [[nodiscard]] static Status ExpressionValidationError(StatusMessage msg)
   {
-    return Status(StatusCode::ExpressionValidationError,
-                  std::move(msg),
-                  "ExpressionValidationError|");
+    return Status(StatusCode::ExpressionValidationError, std::move(msg));
   };
 
-  [[nodiscard]] static Status ExecutionError(std::string&& msg)
+  [[nodiscard]] static Status ExecutionError(StatusMessage msg)
   {
-    return Status(StatusCode::ExecutionError, std::move(msg), "ExecutionError|");
+    return Status(StatusCode::ExecutionError, std::move(msg));
   };
 
-  [[nodiscard]] static Status AlreadyExists(std::string&& msg)
+  [[nodiscard]] static Status AlreadyExists(StatusMessage msg)
   {
-    return Status(StatusCode::AlreadyExists, std::move(msg), "AlreadyExists|");
+    return Status(StatusCode::AlreadyExists, std::move(msg));
   };
 
-  [[nodiscard]] static Status TimeOut(std::string&& msg)
+  [[nodiscard]] static Status TimeOut(StatusMessage msg)
   {
-    return Status(StatusCode::TimeOut, std::move(msg), "TimeOut|");
+    return Status(StatusCode::TimeOut, std::move(msg));
   };
 
   /// @brief get the status
   /// @return 0 if OK or some error code
-  [[nodiscard]] StatusCode status_code() { return _status; };
+  [[nodiscard]] StatusCode status_code() const
+  {
+    return _state ? _state->code : StatusCode::OK;
+  };
 
   [[nodiscard]] Status valueOrDie() { return *this; };
 
   /// @brief check if the status is OK
-  bool ok() { return _status == StatusCode::OK; };
+  bool ok() const { return status_code() == StatusCode::OK; };
 
   /// @brief get status from status
   [[nodiscard]] Status& status() { return *this; };
 
-  /// @brief get the message of the status
-  [[nodiscard]] const std::string to_string() { return _message; };
+  /// @brief get the message of the status, the code name followed by the message, e.g.
+  /// "TimeOut|No response", or just "OK"
+  [[nodiscard]] const std::string to_string() const
+  {
+    if (_state == nullptr) {
+      return "OK";
+    }
+    std::string text = code_name(_state->code);
+    text += '|';
+    text += _state->text();
+    return text;
+  };
 
-  bool operator==(const Status& other) const { return _status == other._status; }
+  bool operator==(const Status& other) const
+  {
+    return status_code() == other.status_code();
+  }
 
-  bool operator==(const StatusCode& other) const { return _status == other; }
+  bool operator==(const StatusCode& other) const { return status_code() == other; }
 
   bool operator!=(const Status& other) const { return !(*this == other); }
 
  private:
-  Status(StatusCode status, std::string&& message, std::string&& status_message)
-    : _status(status)
-    , _message(std::move(status_message + message))
+  struct State
+  {
+    State(StatusCode code, const char* literal, std::string&& message)
+      : code(code)
+      , literal(literal)
+      , message(std::move(message))
+    {
+    }
+
+    StatusCode code;
+    // message of a status created from a string literal, otherwise message is used
+    const char* literal;
+    std::string message;
+
+    std::string_view text() const
+    {
+      return literal ? std::string_view(literal) : std::string_view(message);
+    }
+  };
+
+  /// @brief Code and text of a message, looks up the states interned by text.
+  struct TextKey
+  {
+    StatusCode code;
+    std::string_view text;
+  };
+
+  struct TextHash
+  {
+    using is_transparent = void;
+
+    size_t operator()(const TextKey& key) const
+    {
+      return std::hash<std::string_view>{}(key.text) ^ static_cast<size_t>(key.code);
+    }
+
+    size_t operator()(const State* state) const
+    {
+      return (*this)(TextKey{ state->code, state->text() });
+    }
+  };
+
+  struct TextEqual
+  {
+    using is_transparent = void;
+
+    static TextKey key(const TextKey& key) { return key; }
+    static TextKey key(const State* state) { return { state->code, state->text() }; }
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+      return key(a).code == key(b).code && key(a).text == key(b).text;
+    }
+  };
+
+  // the literal table is probed linearly, a literal that finds no free slot within
+  // k_intern_probes slots is interned by its text instead
+  static constexpr size_t k_intern_slots = 4096;
+  static constexpr size_t k_intern_probes = 16;
+
+  Status(StatusCode status, StatusMessage&& message)
+    : _state(make_state(status, std::move(message)))
   {
   }
-  StatusCode _status;
-  std::string _message;
+
+  static const State* make_state(StatusCode status, StatusMessage&& message)
+  {
+    if (message._literal != nullptr) {
+      if (const State* state = intern_literal(status, message._literal)) {
+        return state;
+      }
+    }
+    return intern_text(status, std::move(message));
+  }
+
+  /// @brief Find or add the shared state of the message text, the text is only copied
+  /// the first time it is seen.
+  static const State* intern_text(StatusCode status, StatusMessage&& message)
+  {
+    static std::mutex mutex;
+    static std::unordered_set<const State*, TextHash, TextEqual> states;
+    TextKey key{ status,
+                 message._literal ? std::string_view(message._literal) : message.text() };
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = states.find(key);
+    if (found != states.end()) {
+      return *found;
+    }
+    std::string text;
+    if (message._formatted) {
+      text = std::move(message._message);
+    } else if (message._literal == nullptr) {
+      text = key.text;
+    }
+    return *states.insert(new State(status, message._literal, std::move(text))).first;
+  }
+
+  /// @brief Find or add the shared state of a string literal, lock free.
+  /// @return nullptr if the table is too full around the slot of the literal.
+  static const State* intern_literal(StatusCode status, const char* literal)
+  {
+    static std::array<std::atomic<const State*>, k_intern_slots> table{};
+    // Fibonacci hashing of the address
+    size_t hash = static_cast<size_t>(
+      (reinterpret_cast<uintptr_t>(literal) * 0x9E3779B97F4A7C15ull) >> 32);
+    hash += static_cast<size_t>(status);
+    State* created = nullptr;
+    for (size_t probe = 0; probe < k_intern_probes; ++probe) {
+      std::atomic<const State*>& slot = table[(hash + probe) % k_intern_slots];
+      const State* state = slot.load(std::memory_order_acquire);
+      if (state == nullptr) {
+        if (created == nullptr) {
+          created = new State(status, literal, {});
+        }
+        if (slot.compare_exchange_strong(
+              state, created, std::memory_order_acq_rel, std::memory_order_acquire)) {
+          return created;
+        }
+        // another thread took the slot, state is its entry now
+      }
+      if (state->code == status && state->literal == literal) {
+        delete created;
+        return state;
+      }
+    }
+    delete created;
+    return nullptr;
+  }
+
+  static const char* code_name(StatusCode status)
+  {
+    switch (status) {
+      case StatusCode::OK:
+        return "OK";
+      case StatusCode::OutOfMemory:
+        return "OutOfMemory";
+      case StatusCode::KeyError:
+        return "KeyError";
+      case StatusCode::TypeError:
+        return "TypeError";
+      case StatusCode::Invalid:
+        return "Invalid";
+      case StatusCode::IOError:
+        return "IOError";
+      case StatusCode::CapacityError:
+        return "CapacityError";
+      case StatusCode::IndexError:
+        return "IndexError";
+      case StatusCode::Cancelled:
+        return "Cancelled";
+      case StatusCode::UnknownError:
+        return "UnknownError";
+      case StatusCode::NotImplemented:
+        return "NotImplemented";
+      case StatusCode::SerializationError:
+        return "SerializationError";
+      case StatusCode::RError:
+        return "RError";
+      case StatusCode::CodeGenError:
+        return "CodeGenError";
+      case StatusCode::ExpressionValidationError:
+        return "ExpressionValidationError";
+      case StatusCode::ExecutionError:
+        return "ExecutionError";
+      case StatusCode::AlreadyExists:
+        return "AlreadyExists";
+      case StatusCode::TimeOut:
+        return "TimeOut";
+    }
+    return "UnknownError";
+  }
+
+  // nullptr for OK without a message
+  const State* _state = nullptr;
 };
 
+static_assert(std::is_trivially_copyable_v<Status>);
+
 /**
  * @brief Result class used as return type.
  *
- * This class is used as a return type for functions that can fail. It contains a status
- * and a value. The Result can be converted to a Status object that contains the status
- * and the message.
+ * This class is used as a return type for functions that can fail. It contains either a
+ * value or the Status of the error. The Result can be converted to a Status object that
+ * contains the status and the message.
  *
+ * The value and the status share storage, so a Result is barely bigger than T. For a
+ * trivially copyable T the Result is trivially copyable too, it is passed in registers
+ * and copied with memcpy.
  */
-
 template<typename T>
 struct Result
 {
  public:
   Result(const Status& status)
-    : _status(std::move(status)){};
+    : _status(status)
+    , _has_value(false){};
+
+  static Result<T> OK(T&& value) { return Result<T>(std::move(value)); }
 
-  static Result<T> OK(T&& value) { return Result<T>(std::move(value), Status::OK()); }
+  /// @brief The value if status is OK, otherwise the error.
+  /// @note A Result holds either a value or an error, no longer both: the value is
+  /// dropped when status is an error, and so is the message of an OK status.
+  [[deprecated("Use Result<T>::OK(value) or Result<T>(status)")]] static Result<T>
+  Propagate(T&& value, Status&& status)
+  {
+    return status.ok() ? Result<T>(std::move(value)) : Result<T>(status);
+  }
+
+  Result(const Result& other)
+    requires std::is_trivially_copy_constructible_v<T>
+  = default;
 
-  static Result<T> Propagate(T&& value, Status&& status)
+  Result(const Result& other)
+    : _has_value(other._has_value)
   {
-    return Result<T>(std::move(value), std::move(status));
+    if (_has_value) {
+      new (&_value) T(other._value);
+    } else {
+      new (&_status) Status(other._status);
+    }
   }
 
-  [[nodiscard]] T& valueOrDie() { return _value.value(); }
+  Result(Result&& other)
+    requires std::is_trivially_move_constructible_v<T>
+  = default;
 
-  [[nodiscard]] Status& status() { return _status; }
+  Result(Result&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+    : _has_value(other._has_value)
+  {
+    if (_has_value) {
+      new (&_value) T(std::move(other._value));
+    } else {
+      new (&_status) Status(other._status);
+    }
+  }
 
-  [[nodiscard]] bool ok() { return _status.ok(); }
+  Result& operator=(const Result& other)
+    requires std::is_trivially_copy_assignable_v<T> &&
+             std::is_trivially_copy_constructible_v<T> &&
+             std::is_trivially_destructible_v<T>
+  = default;
 
-  Result<T>& operator=(const Status& other) { return Result<T>(other); }
+  Result& operator=(const Result& other)
+  {
+    assign(other);
+    return *this;
+  }
+
+  Result& operator=(Result&& other)
+    requires std::is_trivially_move_assignable_v<T> &&
+             std::is_trivially_move_constructible_v<T> &&
+             std::is_trivially_destructible_v<T>
+  = default;
+
+  Result& operator=(Result&& other) noexcept(std::is_nothrow_move_constructible_v<T> &&
+                                             std::is_nothrow_move_assignable_v<T>)
+  {
+    assign(std::move(other));
+    return *this;
+  }
+
+  Result& operator=(const Status& status) noexcept
+  {
+    if (_has_value) {
+      _value.~T();
+      new (&_status) Status(status);
+      _has_value = false;
+    } else {
+      _status = status;
+    }
+    return *this;
+  }
+
+  ~Result()
+    requires std::is_trivially_destructible_v<T>
+  = default;
+
+  ~Result() { destroy(); }
+
+  /// @brief The value, aborts if the Result holds an error.
+  [[nodiscard]] T& valueOrDie()
+  {
+    if (!_has_value) {
+      std::abort();
+    }
+    return _value;
+  }
+
+  /// @brief The error, or an OK Status if the Result holds a value.
+  [[nodiscard]] const Status& status() const
+  {
+    return _has_value ? k_ok_status : _status;
+  }
+
+  [[nodiscard]] bool ok() const { return _has_value || _status.ok(); }
 
  private:
-  Result(T&& value, Status&& status)
+  static constexpr Status k_ok_status{};
+
+  explicit Result(T&& value)
     : _value(std::move(value))
-    , _status(std::move(status)){};
+    , _has_value(true){};
 
-  std::optional<T> _value;
-  // T _value;
+  /// @brief Assign a Result, if copying or moving the value throws, *this is unchanged
+  /// unless both hold a value, then it is as safe as the assignment of T.
+  template<typename Other>
+  void assign(Other&& other)
+  {
+    if (!other._has_value) {
+      *this = other._status;
+    } else if (_has_value) {
+      _value = std::forward<Other>(other)._value;
+    } else {
+      emplace_value(std::forward<Other>(other)._value);
+    }
+  }
+
+  /// @brief Replace the Status with a value, the Status is kept if constructing the
+  /// value throws.
+  template<typename U>
+  void emplace_value(U&& value)
+  {
+    if constexpr (std::is_nothrow_constructible_v<T, U&&>) {
+      new (&_value) T(std::forward<U>(value));
+    } else if constexpr (std::is_nothrow_move_constructible_v<T>) {
+      T temporary(std::forward<U>(value));
+      new (&_value) T(std::move(temporary));
+    } else {
+#if defined(__cpp_exceptions)
+      const Status status = _status;
+      try {
+        new (&_value) T(std::forward<U>(value));
+      } catch (...) {
+        new (&_status) Status(status);
+        throw;
+      }
+#else
+      new (&_value) T(std::forward<U>(value));
+#endif
+    }
+    _has_value = true;
+  }
+
+  void destroy()
+  {
+    if (_has_value) {
+      _value.~T();
+    }
+  }
+
+  union
+  {
+    T _value;
+    Status _status;
+  };
+  bool _has_value;
+};
+
+/**
+ * @brief Result of a function that returns no value, only the Status.
+ */
+template<>
+struct Result<void>
+{
+ public:
+  Result(const Status& status)
+    : _status(status){};
+
+  static Result<void> OK() { return Result<void>(Status::OK()); }
+
+  /// @brief Aborts if the Result holds an error.
+  void valueOrDie()
+  {
+    if (!_status.ok()) {
+      std::abort();
+    }
+  }
+
+  [[nodiscard]] const Status& status() const { return _status; }
+
+  [[nodiscard]] bool ok() const { return _status.ok(); }
+
+ private:
   Status _status;
 };
 
@@ -0,0 +1,902 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#if defined(__linux__)
+
+#include "io_uring_loop.hpp"
+#include "socket_can_bus.hpp"
+#include "socket_can_utils.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <future>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+namespace mcan {
+
+namespace {
+
+/// how long frames rejected with ENOBUFS wait before they are submitted again
+constexpr long long k_tx_retry_ns = 1000000;
+
+/// buffer group used only while probing the kernel features
+constexpr uint16_t k_probe_buffer_group = 0xFFFF;
+
+enum class OpKind : uint8_t
+{
+  Wake = 1,
+  Receive = 2,
+  Send = 3,
+  RetryTimer = 4,
+  Cancel = 5,
+  RequestTimer = 6,
+};
+
+// | 8 bits kind | 8 bits unused | 16 bits channel id | 32 bits slot |
+constexpr uint64_t
+encode_user_data(OpKind kind, uint16_t channel = 0, uint32_t slot = 0)
+{
+  return (static_cast<uint64_t>(kind) << 56) | (static_cast<uint64_t>(channel) << 32) |
+         slot;
+}
+
+constexpr OpKind
+user_data_kind(uint64_t user_data)
+{
+  return static_cast<OpKind>(user_data >> 56);
+}
+
+constexpr uint16_t
+user_data_channel(uint64_t user_data)
+{
+  return static_cast<uint16_t>(user_data >> 32);
+}
+
+constexpr uint32_t
+user_data_slot(uint64_t user_data)
+{
+  return static_cast<uint32_t>(user_data);
+}
+
+int
+sys_io_uring_setup(unsigned entries, io_uring_params* params)
+{
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return static_cast<int>(
+    syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int
+sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+bool
+is_retryable_send_error(int32_t res)
+{
+  return res == -EAGAIN || res == -ENOBUFS || res == -EINTR || res == -ECANCELED;
+}
+
+/// @brief Provided buffer ring shared with the kernel.
+class BufferRing
+{
+ public:
+  ~BufferRing() { release(); }
+
+  Status setup(int ring_fd, uint16_t group_id, unsigned entries)
+  {
+    _ring_fd = ring_fd;
+    _group_id = group_id;
+    _mask = entries - 1;
+    _size = entries * sizeof(io_uring_buf);
+    void* mem =
+      mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (mem == MAP_FAILED) {
+      return Status::OutOfMemory(detail::errno_message("Failed to map buffer ring"));
+    }
+    _ring = static_cast<io_uring_buf_ring*>(mem);
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(_ring);
+    reg.ring_entries = entries;
+    reg.bgid = group_id;
+    if (sys_io_uring_register(_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+      Status status =
+        Status::NotImplemented(detail::errno_message("Failed to register buffer ring"));
+      munmap(_ring, _size);
+      _ring = nullptr;
+      return status;
+    }
+    _registered = true;
+    return Status::OK();
+  }
+
+  /// @brief Give the buffer back to the kernel.
+  void provide(void* addr, uint32_t len, uint16_t buffer_id)
+  {
+    // only addr, len and bid are written, resv of the first entry overlays the tail
+    io_uring_buf& buf = _ring->bufs[_tail & _mask];
+    buf.addr = reinterpret_cast<uint64_t>(addr);
+    buf.len = len;
+    buf.bid = buffer_id;
+    ++_tail;
+    __atomic_store_n(&_ring->tail, _tail, __ATOMIC_RELEASE);
+  }
+
+  void release()
+  {
+    if (_registered) {
+      io_uring_buf_reg reg{};
+      reg.bgid = _group_id;
+      sys_io_uring_register(_ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+      _registered = false;
+    }
+    if (_ring != nullptr) {
+      munmap(_ring, _size);
+      _ring = nullptr;
+    }
+  }
+
+ private:
+  int _ring_fd = -1;
+  uint16_t _group_id = 0;
+  uint16_t _tail = 0;
+  unsigned _mask = 0;
+  size_t _size = 0;
+  io_uring_buf_ring* _ring = nullptr;
+  bool _registered = false;
+};
+
+} // namespace
+
+/// @brief Minimal io_uring wrapper, the kernel interface is used directly so there is no
+/// dependency on liburing.
+struct IoUringLoop::Ring
+{
+  ~Ring()
+  {
+    if (sqes != nullptr) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_map != nullptr && cq_map != sq_map) {
+      munmap(cq_map, cq_map_size);
+    }
+    if (sq_map != nullptr) {
+      munmap(sq_map, sq_map_size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  Status setup(unsigned entries, unsigned cq_entries)
+  {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = cq_entries;
+    fd = sys_io_uring_setup(entries, &params);
+    if (fd < 0) {
+      return Status::NotImplemented(detail::errno_message("io_uring is not available"));
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      return Status::NotImplemented("io_uring kernel support is too old"_status);
+    }
+
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sq_map_size = std::max(sq_map_size, cq_map_size);
+    cq_map_size = sq_map_size;
+    void* map = mmap(nullptr,
+                     sq_map_size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE,
+                     fd,
+                     IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED) {
+      return Status::OutOfMemory(detail::errno_message("Failed to map io_uring rings"));
+    }
+    sq_map = map;
+    cq_map = map;
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    map = mmap(nullptr,
+               sqes_size,
+               PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE,
+               fd,
+               IORING_OFF_SQES);
+    if (map == MAP_FAILED) {
+      return Status::OutOfMemory(detail::errno_message("Failed to map io_uring SQEs"));
+    }
+    sqes = static_cast<io_uring_sqe*>(map);
+
+    auto* sq = static_cast<uint8_t*>(sq_map);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    auto* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    // SQEs are always used in ring order so the index array is an identity mapping
+    for (unsigned i = 0; i < sq_entries; ++i) {
+      sq_array[i] = i;
+    }
+    local_tail = *sq_tail;
+
+    auto* cq = static_cast<uint8_t*>(cq_map);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return Status::OK();
+  }
+
+  unsigned free_sqes() const
+  {
+    return sq_entries - (local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+  }
+
+  /// @brief Make sure count SQEs are free, submits pending entries first if needed.
+  /// @return false if the kernel does not take the pending entries, e.g. because the
+  /// completion queue is full and has to be reaped first.
+  bool reserve(unsigned count)
+  {
+    if (free_sqes() < count) {
+      submit(false);
+    }
+    return free_sqes() >= count;
+  }
+
+  /// @brief Get a zeroed SQE, submits pending entries first if the queue is full.
+  /// @return nullptr if no SQE can be freed now, see reserve().
+  io_uring_sqe* get_sqe()
+  {
+    if (!reserve(1)) {
+      return nullptr;
+    }
+    io_uring_sqe* sqe = &sqes[local_tail & sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    ++local_tail;
+    return sqe;
+  }
+
+  /// @brief Submit all prepared SQEs and optionally wait for at least one completion.
+  void submit(bool wait)
+  {
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    unsigned pending = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    while (sys_io_uring_enter(fd, pending, wait ? 1 : 0, flags) < 0) {
+      // EBUSY means the completion queue is full, the caller has to reap it first
+      if (errno != EINTR) {
+        return;
+      }
+      pending = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    }
+  }
+
+  template<typename F>
+  void reap(F&& on_completion)
+  {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+      const io_uring_cqe& cqe = cqes[head & cq_mask];
+      on_completion(cqe.user_data, cqe.res, cqe.flags);
+      ++head;
+      if (head == tail) {
+        // completions can be posted while we are processing the previous ones
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  int fd = -1;
+  void* sq_map = nullptr;
+  size_t sq_map_size = 0;
+  void* cq_map = nullptr;
+  size_t cq_map_size = 0;
+  io_uring_sqe* sqes = nullptr;
+  size_t sqes_size = 0;
+  unsigned* sq_head = nullptr;
+  unsigned* sq_tail = nullptr;
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+  unsigned local_tail = 0;
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned cq_mask = 0;
+  io_uring_cqe* cqes = nullptr;
+  __kernel_timespec retry_timeout{ 0, k_tx_retry_ns };
+};
+
+/// @brief State of one attached bus, only touched by the loop thread.
+struct IoUringLoop::Channel
+{
+  SocketCanBus* bus = nullptr;
+  int fd = -1;
+  uint16_t id = 0;
+  BufferRing buffer_ring;
+  std::vector<canfd_frame> rx_buffers;
+  std::vector<CanFrame> rx_frames;
+  size_t rx_count = 0;
+  bool receive_armed = false;
+  // set after a receive error until the retry timer fires, rx_failing until a frame
+  // arrives again so the error is reported once
+  bool receive_backoff = false;
+  bool rx_failing = false;
+  // poll of the bus timerfd expiring send_await_response_async() requests
+  bool request_timer_armed = false;
+  // set on detach until the cancellation of the receive and timer poll is submitted
+  bool cancel_pending = false;
+
+  // the chain currently owned by the kernel
+  std::vector<CanFrame> tx_frames;
+  std::vector<canfd_frame> tx_slots;
+  std::vector<int32_t> tx_results;
+  unsigned tx_chain = 0;
+  unsigned tx_completed = 0;
+  // frames rejected by the kernel, they are sent again before the bus queue
+  std::vector<CanFrame> tx_retry;
+  bool waiting_for_retry = false;
+
+  Command* detach_command = nullptr;
+};
+
+struct IoUringLoop::Command
+{
+  bool attach;
+  SocketCanBus* bus;
+  int fd;
+  std::promise<Status> done;
+};
+
+Result<std::shared_ptr<IoUringLoop>>
+IoUringLoop::create(IoUringLoopConfig config)
+{
+  if (config.rx_buffers_per_bus == 0 ||
+      (config.rx_buffers_per_bus & (config.rx_buffers_per_bus - 1)) != 0 ||
+      config.rx_buffers_per_bus > 32768) {
+    return Status::Invalid(
+      "rx_buffers_per_bus must be a power of two up to 32768"_status);
+  }
+  if (config.tx_chain_length == 0 || config.tx_chain_length >= config.queue_depth) {
+    return Status::Invalid(
+      "tx_chain_length must be between 1 and queue_depth - 1"_status);
+  }
+  std::shared_ptr<IoUringLoop> loop(new IoUringLoop(config));
+  ARI_RETURN_ON_ERROR(loop->start());
+  return Result<std::shared_ptr<IoUringLoop>>::OK(std::move(loop));
+}
+
+IoUringLoop::IoUringLoop(IoUringLoopConfig config)
+  : _config(config)
+  , _ring(std::make_unique<Ring>())
+{
+}
+
+IoUringLoop::~IoUringLoop()
+{
+  if (_thread.joinable()) {
+    _stopping = true;
+    wake();
+    _thread.join();
+  }
+  // closing the ring cancels everything that is still in flight
+  _channels.clear();
+  _ring.reset();
+  if (_wake_fd >= 0) {
+    close(_wake_fd);
+  }
+}
+
+Status
+IoUringLoop::start()
+{
+  ARI_RETURN_ON_ERROR(_ring->setup(_config.queue_depth, _config.queue_depth * 8));
+
+  // io_uring itself may be available while multishot receive (6.0) is not, the only
+  // reliable check is to try it on a socket pair
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) {
+    return Status::IOError(detail::errno_message("Failed to create probe socket pair"));
+  }
+  bool supported = false;
+  {
+    BufferRing probe_ring;
+    uint8_t probe_buffer[16];
+    Status status = probe_ring.setup(_ring->fd, k_probe_buffer_group, 1);
+    if (status.ok()) {
+      probe_ring.provide(probe_buffer, sizeof(probe_buffer), 0);
+      io_uring_sqe* sqe = _ring->get_sqe();
+      sqe->opcode = IORING_OP_RECV;
+      sqe->fd = pair[0];
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->flags = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = k_probe_buffer_group;
+      sqe->user_data = encode_user_data(OpKind::Receive);
+      uint8_t byte = 0;
+      [[maybe_unused]] ssize_t ret = ::send(pair[1], &byte, 1, 0);
+      bool received = false;
+      bool receive_done = false;
+      while (!received) {
+        _ring->submit(true);
+        _ring->reap([&](uint64_t user_data, int32_t res, uint32_t flags) {
+          if (user_data_kind(user_data) != OpKind::Receive) {
+            return;
+          }
+          if (!received) {
+            supported =
+              res == 1 && (flags & IORING_CQE_F_BUFFER) && (flags & IORING_CQE_F_MORE);
+            received = true;
+          }
+          receive_done = receive_done || !(flags & IORING_CQE_F_MORE);
+        });
+      }
+      // closing the socket terminates the multishot receive, wait for its last CQE so
+      // the probe buffer ring is not in use when it is unregistered
+      close(pair[0]);
+      close(pair[1]);
+      pair[0] = pair[1] = -1;
+      if (!receive_done) {
+        sqe = _ring->get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = encode_user_data(OpKind::Receive);
+        sqe->user_data = encode_user_data(OpKind::Cancel);
+      }
+      while (!receive_done) {
+        _ring->submit(true);
+        _ring->reap([&](uint64_t user_data, int32_t, uint32_t flags) {
+          if (user_data_kind(user_data) == OpKind::Receive &&
+              !(flags & IORING_CQE_F_MORE)) {
+            receive_done = true;
+          }
+        });
+      }
+    }
+  }
+  if (pair[0] >= 0) {
+    close(pair[0]);
+    close(pair[1]);
+  }
+  if (!supported) {
+    return Status::NotImplemented(
+      "io_uring multishot receive with provided buffers is not supported by the "
+      "kernel"_status);
+  }
+
+  _wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_wake_fd < 0) {
+    return Status::IOError(detail::errno_message("Failed to create eventfd"));
+  }
+  _thread = std::thread(&IoUringLoop::run, this);
+  return Status::OK();
+}
+
+Status
+IoUringLoop::attach(SocketCanBus& bus, int fd)
+{
+  // io_uring only parks a request on the socket wait queue if the socket is blocking,
+  // with O_NONBLOCK every empty receive would complete with EAGAIN
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+    return Status::IOError(detail::errno_message("Failed to configure CAN socket"));
+  }
+  Command command{ true, &bus, fd, {} };
+  std::future<Status> done = command.done.get_future();
+  {
+    std::lock_guard<std::mutex> lock(_commands_mutex);
+    _commands.push_back(&command);
+  }
+  wake();
+  Status status = done.get();
+  if (!status.ok()) {
+    fcntl(fd, F_SETFL, flags);
+  }
+  return status;
+}
+
+void
+IoUringLoop::detach(SocketCanBus& bus)
+{
+  Command command{ false, &bus, -1, {} };
+  std::future<Status> done = command.done.get_future();
+  {
+    std::lock_guard<std::mutex> lock(_commands_mutex);
+    _commands.push_back(&command);
+  }
+  wake();
+  (void)done.get();
+}
+
+void
+IoUringLoop::wake()
+{
+  detail::event_fd_signal(_wake_fd);
+}
+
+void
+IoUringLoop::run()
+{
+  while (!_stopping) {
+    process_commands();
+    arm_pending();
+    for (auto& channel : _channels) {
+      if (channel) {
+        flush_tx(*channel);
+      }
+    }
+    _ring->submit(true);
+    _ring->reap([this](uint64_t user_data, int32_t res, uint32_t flags) {
+      handle_completion(user_data, res, flags);
+    });
+    for (auto& channel : _channels) {
+      if (channel && channel->rx_count > 0) {
+        channel->bus->dispatch(channel->rx_frames.data(), channel->rx_count);
+        channel->rx_count = 0;
+      }
+    }
+  }
+}
+
+void
+IoUringLoop::process_commands()
+{
+  std::vector<Command*> commands;
+  {
+    std::lock_guard<std::mutex> lock(_commands_mutex);
+    commands.swap(_commands);
+  }
+  for (Command* command : commands) {
+    if (command->attach) {
+      auto free_slot = std::find(_channels.begin(), _channels.end(), nullptr);
+      size_t id = static_cast<size_t>(free_slot - _channels.begin());
+      if (id >= k_probe_buffer_group) {
+        command->done.set_value(Status::CapacityError("Too many buses attached"_status));
+        continue;
+      }
+      auto channel = std::make_unique<Channel>();
+      channel->bus = command->bus;
+      channel->fd = command->fd;
+      channel->id = static_cast<uint16_t>(id);
+      Status status = channel->buffer_ring.setup(
+        _ring->fd, channel->id, _config.rx_buffers_per_bus);
+      if (!status.ok()) {
+        command->done.set_value(status);
+        continue;
+      }
+      channel->rx_buffers.resize(_config.rx_buffers_per_bus);
+      channel->rx_frames.resize(_config.rx_buffers_per_bus);
+      for (unsigned i = 0; i < _config.rx_buffers_per_bus; ++i) {
+        channel->buffer_ring.provide(
+          &channel->rx_buffers[i], sizeof(canfd_frame), static_cast<uint16_t>(i));
+      }
+      channel->tx_frames.resize(_config.tx_chain_length);
+      channel->tx_slots.resize(_config.tx_chain_length);
+      channel->tx_results.resize(_config.tx_chain_length);
+      // a full SQ leaves them to arm_pending()
+      arm_receive(*channel);
+      arm_request_timer(*channel);
+      if (free_slot == _channels.end()) {
+        _channels.push_back(std::move(channel));
+      } else {
+        *free_slot = std::move(channel);
+      }
+      command->done.set_value(Status::OK());
+    } else {
+      auto it = std::find_if(_channels.begin(), _channels.end(), [&](auto& channel) {
+        return channel && channel->bus == command->bus;
+      });
+      if (it == _channels.end()) {
+        command->done.set_value(Status::KeyError("Bus is not attached"_status));
+        continue;
+      }
+      Channel& channel = **it;
+      channel.detach_command = command;
+      channel.tx_retry.clear();
+      channel.waiting_for_retry = false;
+      channel.cancel_pending = true;
+      arm_cancel(channel);
+      try_finish_detach(channel);
+    }
+  }
+}
+
+void
+IoUringLoop::arm_pending()
+{
+  if (!_wake_armed) {
+    arm_wake();
+  }
+  bool waiting_for_retry = false;
+  for (auto& channel : _channels) {
+    if (!channel) {
+      continue;
+    }
+    if (channel->detach_command != nullptr) {
+      if (channel->cancel_pending) {
+        arm_cancel(*channel);
+      }
+      continue;
+    }
+    if (!channel->receive_armed && !channel->receive_backoff) {
+      arm_receive(*channel);
+    }
+    if (!channel->request_timer_armed) {
+      arm_request_timer(*channel);
+    }
+    waiting_for_retry |= channel->waiting_for_retry || channel->receive_backoff;
+  }
+  if (waiting_for_retry) {
+    arm_retry_timer();
+  }
+}
+
+void
+IoUringLoop::arm_cancel(Channel& channel)
+{
+  // cancels the multishot receive, a send chain that waits for the socket and the poll
+  // of the request timer, both SQEs are taken at once so none is submitted twice
+  if (!_ring->reserve(2)) {
+    return;
+  }
+  io_uring_sqe* sqe = _ring->get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = channel.fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD;
+  sqe->user_data = encode_user_data(OpKind::Cancel);
+  sqe = _ring->get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = channel.bus->_timer_fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD;
+  sqe->user_data = encode_user_data(OpKind::Cancel);
+  channel.cancel_pending = false;
+}
+
+void
+IoUringLoop::arm_wake()
+{
+  io_uring_sqe* sqe = _ring->get_sqe();
+  if (sqe == nullptr) {
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = _wake_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = encode_user_data(OpKind::Wake);
+  _wake_armed = true;
+}
+
+void
+IoUringLoop::arm_receive(Channel& channel)
+{
+  io_uring_sqe* sqe = _ring->get_sqe();
+  if (sqe == nullptr) {
+    return;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = channel.fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = channel.id;
+  sqe->user_data = encode_user_data(OpKind::Receive, channel.id);
+  channel.receive_armed = true;
+}
+
+void
+IoUringLoop::arm_request_timer(Channel& channel)
+{
+  io_uring_sqe* sqe = _ring->get_sqe();
+  if (sqe == nullptr) {
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = channel.bus->_timer_fd;
+  sqe->poll32_events = POLLIN;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->user_data = encode_user_data(OpKind::RequestTimer, channel.id);
+  channel.request_timer_armed = true;
+}
+
+void
+IoUringLoop::arm_retry_timer()
+{
+  if (_retry_timer_armed) {
+    return;
+  }
+  io_uring_sqe* sqe = _ring->get_sqe();
+  if (sqe == nullptr) {
+    return;
+  }
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->addr = reinterpret_cast<uint64_t>(&_ring->retry_timeout);
+  sqe->len = 1;
+  sqe->user_data = encode_user_data(OpKind::RetryTimer);
+  _retry_timer_armed = true;
+}
+
+void
+IoUringLoop::flush_tx(Channel& channel)
+{
+  if (channel.detach_command != nullptr || channel.waiting_for_retry ||
+      channel.tx_completed != channel.tx_chain) {
+    return;
+  }
+  // only one chain per bus is in flight so frames leave the socket in queue order, the
+  // whole chain has to fit into the SQ or the kernel would cut the link
+  size_t max_frames = std::min<size_t>(_config.tx_chain_length, _ring->free_sqes());
+  size_t count = std::min(max_frames, channel.tx_retry.size());
+  std::copy_n(channel.tx_retry.begin(), count, channel.tx_frames.begin());
+  channel.tx_retry.erase(channel.tx_retry.begin(), channel.tx_retry.begin() + count);
+  if (count < max_frames) {
+    count += channel.bus->take_tx_frames(&channel.tx_frames[count], max_frames - count);
+  }
+  if (count == 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    size_t size = detail::to_socket_frame(channel.tx_frames[i], channel.tx_slots[i]);
+    io_uring_sqe* sqe = _ring->get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = channel.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&channel.tx_slots[i]);
+    sqe->len = static_cast<uint32_t>(size);
+    sqe->flags = (i + 1 < count) ? IOSQE_IO_LINK : 0;
+    sqe->user_data =
+      encode_user_data(OpKind::Send, channel.id, static_cast<uint32_t>(i));
+  }
+  channel.tx_chain = static_cast<unsigned>(count);
+  channel.tx_completed = 0;
+}
+
+void
+IoUringLoop::handle_completion(uint64_t user_data, int32_t res, uint32_t flags)
+{
+  switch (user_data_kind(user_data)) {
+    case OpKind::Wake:
+      detail::event_fd_clear(_wake_fd);
+      _wake_armed = (flags & IORING_CQE_F_MORE) != 0;
+      return;
+    case OpKind::RetryTimer:
+      _retry_timer_armed = false;
+      for (auto& channel : _channels) {
+        if (channel) {
+          channel->waiting_for_retry = false;
+          channel->receive_backoff = false;
+        }
+      }
+      return;
+    case OpKind::Cancel:
+      return;
+    default:
+      break;
+  }
+
+  uint16_t id = user_data_channel(user_data);
+  if (id >= _channels.size() || !_channels[id]) {
+    return;
+  }
+  Channel& channel = *_channels[id];
+
+  if (user_data_kind(user_data) == OpKind::RequestTimer) {
+    if (res > 0) {
+      channel.bus->expire_requests();
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+      // armed again by arm_pending() unless the bus is being detached
+      channel.request_timer_armed = false;
+      try_finish_detach(channel);
+    }
+    return;
+  }
+
+  if (user_data_kind(user_data) == OpKind::Receive) {
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+      auto buffer_id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+      if (channel.rx_count == channel.rx_frames.size()) {
+        channel.bus->dispatch(channel.rx_frames.data(), channel.rx_count);
+        channel.rx_count = 0;
+      }
+      if (detail::from_socket_frame(channel.rx_buffers[buffer_id],
+                                    static_cast<size_t>(res),
+                                    channel.rx_frames[channel.rx_count])) {
+        ++channel.rx_count;
+      }
+      channel.buffer_ring.provide(
+        &channel.rx_buffers[buffer_id], sizeof(canfd_frame), buffer_id);
+    }
+    if (res > 0) {
+      channel.rx_failing = false;
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED &&
+               channel.detach_command == nullptr) {
+      // e.g. ENETDOWN while the interface is bounced, retried after the retry timer
+      if (!channel.rx_failing) {
+        channel.bus->report_rx_error(-res);
+      }
+      channel.rx_failing = true;
+      channel.receive_backoff = true;
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+      // the kernel terminates the multishot receive when it runs out of buffers or on
+      // error, arm_pending() arms it again unless we are the ones cancelling it
+      channel.receive_armed = false;
+      try_finish_detach(channel);
+    }
+    return;
+  }
+
+  // OpKind::Send
+  channel.tx_results[user_data_slot(user_data)] = res;
+  if (++channel.tx_completed != channel.tx_chain) {
+    return;
+  }
+  std::vector<CanFrame> retry;
+  for (unsigned i = 0; i < channel.tx_chain; ++i) {
+    if (channel.tx_results[i] < 0 && is_retryable_send_error(channel.tx_results[i])) {
+      retry.push_back(channel.tx_frames[i]);
+    }
+    // any other error means the frame can not be sent at all (e.g. interface is down),
+    // it is dropped so the queue does not get stuck on it
+  }
+  if (!retry.empty() && channel.detach_command == nullptr) {
+    channel.tx_retry.insert(channel.tx_retry.begin(), retry.begin(), retry.end());
+    channel.waiting_for_retry = true;
+    arm_retry_timer();
+  }
+  try_finish_detach(channel);
+}
+
+void
+IoUringLoop::try_finish_detach(Channel& channel)
+{
+  if (channel.detach_command == nullptr || channel.receive_armed ||
+      channel.request_timer_armed || channel.tx_completed != channel.tx_chain) {
+    return;
+  }
+  Command* command = channel.detach_command;
+  // frames received before the cancellation still belong to the bus
+  if (channel.rx_count > 0) {
+    channel.bus->dispatch(channel.rx_frames.data(), channel.rx_count);
+  }
+  _channels[channel.id].reset();
+  command->done.set_value(Status::OK());
+}
+
+} // namespace mcan
+
+#endif // __linux__
@@ -0,0 +1,1112 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+#if defined(__linux__)
+
+#include "socket_can_bus.hpp"
+#include "socket_can_utils.hpp"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace mcan {
+
+namespace {
+
+/// how long the TX thread waits before retrying when the interface queue is full,
+/// the kernel does not wake up epoll on ENOBUFS so we have to retry on our own
+constexpr int k_tx_retry_ms = 1;
+
+constexpr int k_max_epoll_events = 4;
+
+/// back off of the RX thread after a receive error, doubled on every further error, so a
+/// socket that keeps failing does not wake it up in a loop
+constexpr int k_rx_retry_min_ms = 1;
+constexpr int k_rx_retry_max_ms = 1000;
+
+/// bits of a repo CAN ID that the kernel filter compares, the extended frame flag is left
+/// out so a filter matches both frame formats the same way callbacks do
+constexpr uint32_t k_filter_id_bits = CAN_EFF_MASK | CAN_RTR_FLAG;
+
+/// filters a rebuilt kernel filter is merged down to, the rest of CAN_RAW_FILTER_MAX is
+/// left for the response IDs requests append until the next rebuild
+constexpr size_t k_kernel_filter_limit = CAN_RAW_FILTER_MAX / 2;
+
+/// bus whose RX thread the current thread is, callbacks of the bus run on it so
+/// close_can() can not join it from there
+thread_local const SocketCanBus* t_rx_thread_bus = nullptr;
+
+static_assert(CAN_REMOTE_REQUEST_FLAG == CAN_RTR_FLAG,
+              "remote request flag must match the SocketCAN one to filter on it");
+
+/// @brief Merge filters until at most limit of them are left.
+/// Two filters are merged into one that accepts everything both of them accept: the
+/// mask keeps only the bits on which both agree. Pairs are taken from the filters sorted
+/// by ID, so neighbours usually differ only in the node id or a few low bits, and the
+/// pairs whose merge widens the filter the least go first.
+template<typename Filter>
+void
+merge_filters(std::vector<Filter>& filters, size_t limit)
+{
+  struct Candidate
+  {
+    int wildcard_bits;
+    size_t index;
+  };
+
+  auto by_id = [](const Filter& a, const Filter& b) {
+    return a.id != b.id ? a.id < b.id : a.mask < b.mask;
+  };
+  std::vector<Candidate> candidates;
+  std::vector<bool> used;
+  std::vector<bool> removed;
+  while (filters.size() > limit) {
+    std::sort(filters.begin(), filters.end(), by_id);
+    candidates.clear();
+    for (size_t i = 0; i + 1 < filters.size(); ++i) {
+      const Filter& a = filters[i];
+      const Filter& b = filters[i + 1];
+      uint32_t mask = a.mask & b.mask & ~(a.id ^ b.id);
+      candidates.push_back(Candidate{ 32 - std::popcount(mask), i });
+    }
+    std::stable_sort(candidates.begin(),
+                     candidates.end(),
+                     [](const Candidate& a, const Candidate& b) {
+                       return a.wildcard_bits < b.wildcard_bits;
+                     });
+
+    // merge disjoint pairs only, the rest waits for the next round when the merged
+    // filters got new neighbours
+    size_t excess = filters.size() - limit;
+    used.assign(filters.size(), false);
+    removed.assign(filters.size(), false);
+    for (const Candidate& candidate : candidates) {
+      if (excess == 0) {
+        break;
+      }
+      size_t i = candidate.index;
+      if (used[i] || used[i + 1]) {
+        continue;
+      }
+      Filter& first = filters[i];
+      const Filter& second = filters[i + 1];
+      first.mask &= second.mask & ~(first.id ^ second.id);
+      first.id &= first.mask;
+      used[i] = true;
+      used[i + 1] = true;
+      removed[i + 1] = true;
+      --excess;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < filters.size(); ++i) {
+      if (!removed[i]) {
+        filters[kept++] = filters[i];
+      }
+    }
+    filters.resize(kept);
+  }
+}
+
+bool
+epoll_add(int epoll_fd, int fd, uint32_t events)
+{
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool
+epoll_modify(int epoll_fd, int fd, uint32_t events)
+{
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+} // namespace
+
+using detail::errno_message;
+using detail::event_fd_clear;
+using detail::event_fd_signal;
+using detail::from_socket_frame;
+using detail::to_socket_frame;
+
+/// @brief Preallocated buffers for one recvmmsg/sendmmsg call.
+struct SocketCanBus::IoBatch
+{
+  explicit IoBatch(size_t size)
+    : raw(size)
+    , iovecs(size)
+    , messages(size)
+    , frames(size)
+  {
+  }
+
+  /// @brief Point every message header back at its frame buffer, the kernel overwrites
+  /// msg_len and the flags on every call. Buffers are sized for CAN FD frames, classic
+  /// frames use only the first CAN_MTU bytes.
+  void reset()
+  {
+    for (size_t i = 0; i < messages.size(); ++i) {
+      iovecs[i].iov_base = &raw[i];
+      iovecs[i].iov_len = sizeof(canfd_frame);
+      std::memset(&messages[i], 0, sizeof(mmsghdr));
+      messages[i].msg_hdr.msg_iov = &iovecs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+  }
+
+  std::vector<canfd_frame> raw;
+  std::vector<iovec> iovecs;
+  std::vector<mmsghdr> messages;
+  std::vector<CanFrame> frames;
+};
+
+SocketCanBus::SocketCanBus(SocketCanConfig config)
+  : _config(std::move(config))
+{
+}
+
+SocketCanBus::SocketCanBus(const std::string& interface_name)
+{
+  _config.interface_name = interface_name;
+}
+
+SocketCanBus::~SocketCanBus()
+{
+  (void)close_can();
+}
+
+Status
+SocketCanBus::open_can()
+{
+  ARI_RETURN_ON_ERROR(check_config());
+
+  _socket_fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+  if (_socket_fd < 0) {
+    return Status::IOError(errno_message("Failed to create CAN socket"));
+  }
+
+  unsigned int if_index = if_nametoindex(_config.interface_name.c_str());
+  if (if_index == 0) {
+    Status status = Status::IOError(errno_message("Unknown CAN interface"));
+    close_fds();
+    return status;
+  }
+
+  // CAN FD frames are used only if the interface is configured for them (its MTU is
+  // CANFD_MTU), otherwise the kernel would reject every FD frame we send
+  _fd_enabled = false;
+  if (_config.enable_fd) {
+    ifreq request{};
+    std::strncpy(request.ifr_name, _config.interface_name.c_str(), IFNAMSIZ - 1);
+    if (ioctl(_socket_fd, SIOCGIFMTU, &request) == 0 && request.ifr_mtu == CANFD_MTU) {
+      int enable = 1;
+      _fd_enabled = setsockopt(_socket_fd,
+                               SOL_CAN_RAW,
+                               CAN_RAW_FD_FRAMES,
+                               &enable,
+                               sizeof(enable)) == 0;
+    }
+  }
+
+  sockaddr_can addr{};
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = static_cast<int>(if_index);
+  if (bind(_socket_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    Status status = Status::IOError(errno_message("Failed to bind CAN socket"));
+    close_fds();
+    return status;
+  }
+  return start_io();
+}
+
+Status
+SocketCanBus::open_can(int socket_fd)
+{
+  Status status = check_config();
+  if (!status.ok()) {
+    close(socket_fd);
+    return status;
+  }
+  _socket_fd = socket_fd;
+  int flags = fcntl(_socket_fd, F_GETFL);
+  if (flags < 0 || fcntl(_socket_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    status = Status::IOError(errno_message("Failed to configure CAN socket"));
+    close_fds();
+    return status;
+  }
+  // the caller decides about CAN FD frames when setting up the socket
+  int enabled = 0;
+  socklen_t size = sizeof(enabled);
+  _fd_enabled = _config.enable_fd &&
+                getsockopt(
+                  _socket_fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enabled, &size) == 0 &&
+                enabled != 0;
+  return start_io();
+}
+
+Status
+SocketCanBus::check_config() const
+{
+  if (_running) {
+    return Status::AlreadyExists("CAN socket is already open"_status);
+  }
+  if (_config.tx_queue_capacity == 0) {
+    return Status::Invalid("TX queue capacity must be greater than 0"_status);
+  }
+  if (_config.io_batch_size == 0) {
+    return Status::Invalid("I/O batch size must be greater than 0"_status);
+  }
+  return Status::OK();
+}
+
+Status
+SocketCanBus::start_io()
+{
+  if (_config.rx_socket_buffer_size > 0) {
+    // not fatal, without privileges the kernel caps the buffer at rmem_max
+    (void)setsockopt(_socket_fd,
+                     SOL_SOCKET,
+                     SO_RCVBUF,
+                     &_config.rx_socket_buffer_size,
+                     sizeof(_config.rx_socket_buffer_size));
+  }
+
+  update_kernel_filter();
+
+  {
+    std::lock_guard<std::mutex> lock(_tx_mutex);
+    _tx_queue.assign(_config.tx_queue_capacity, CanFrame{});
+    _tx_head = 0;
+    _tx_count = 0;
+  }
+
+  _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (_timer_fd < 0) {
+    Status status = Status::IOError(errno_message("Failed to create timerfd"));
+    close_fds();
+    return status;
+  }
+  _timer_tick = PendingTable::k_no_expiry;
+
+  _running = true;
+  if (_config.io_uring_loop) {
+    if (_config.io_uring_loop->attach(*this, _socket_fd).ok()) {
+      std::lock_guard<std::mutex> lock(_tx_mutex);
+      _io_uring_loop = _config.io_uring_loop;
+      // frames queued before the loop was published did not wake it up
+      if (_tx_count > 0) {
+        _io_uring_loop->wake();
+      }
+      return Status::OK();
+    }
+    // the socket is still usable, serve it with our own threads
+  }
+  Status status = start_threads();
+  if (!status.ok()) {
+    _running = false;
+    close_fds();
+  }
+  return status;
+}
+
+Status
+SocketCanBus::start_threads()
+{
+  _tx_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _stop_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  _rx_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  _tx_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (_tx_event_fd < 0 || _stop_event_fd < 0 || _rx_epoll_fd < 0 || _tx_epoll_fd < 0) {
+    return Status::IOError(errno_message("Failed to create epoll/eventfd"));
+  }
+
+  // the socket is registered in the TX epoll without events, EPOLLOUT is enabled only
+  // when the kernel buffer is full and we have to wait for it to drain
+  if (!epoll_add(_rx_epoll_fd, _socket_fd, EPOLLIN) ||
+      !epoll_add(_rx_epoll_fd, _stop_event_fd, EPOLLIN) ||
+      !epoll_add(_rx_epoll_fd, _timer_fd, EPOLLIN) ||
+      !epoll_add(_tx_epoll_fd, _socket_fd, 0) ||
+      !epoll_add(_tx_epoll_fd, _tx_event_fd, EPOLLIN) ||
+      !epoll_add(_tx_epoll_fd, _stop_event_fd, EPOLLIN)) {
+    return Status::IOError(errno_message("Failed to register epoll events"));
+  }
+
+  _rx_batch = std::make_unique<IoBatch>(_config.io_batch_size);
+  _tx_batch = std::make_unique<IoBatch>(_config.io_batch_size);
+  _rx_thread = std::thread(&SocketCanBus::rx_loop, this);
+  _tx_thread = std::thread(&SocketCanBus::tx_loop, this);
+  return Status::OK();
+}
+
+Status
+SocketCanBus::close_can()
+{
+  // the RX thread would join itself, the io_uring loop would wait for its own detach
+  if (t_rx_thread_bus == this) {
+    return Status::Invalid(
+      "close_can() can not be called from a callback of the CAN bus"_status);
+  }
+  {
+    std::lock_guard<std::mutex> lock(_tx_mutex);
+    if (_io_uring_loop && _io_uring_loop->runs_on_loop_thread()) {
+      return Status::Invalid(
+        "close_can() can not be called from the io_uring loop thread"_status);
+    }
+  }
+  if (!_running.exchange(false)) {
+    return Status::OK();
+  }
+  std::shared_ptr<IoUringLoop> loop;
+  {
+    // send() uses the loop under _tx_mutex, it falls back to the TX eventfd from now on
+    std::lock_guard<std::mutex> lock(_tx_mutex);
+    loop = std::move(_io_uring_loop);
+  }
+  if (loop) {
+    loop->detach(*this);
+  } else {
+    event_fd_signal(_stop_event_fd);
+    if (_rx_thread.joinable()) {
+      _rx_thread.join();
+    }
+    if (_tx_thread.joinable()) {
+      _tx_thread.join();
+    }
+  }
+  close_fds();
+  cancel_requests(Status::Cancelled("CAN bus was closed"_status));
+  return Status::OK();
+}
+
+void
+SocketCanBus::close_fds()
+{
+  std::lock_guard<std::mutex> lock(_filter_mutex);
+  // send() signals _tx_event_fd under _tx_mutex
+  std::lock_guard<std::mutex> tx_lock(_tx_mutex);
+  _kernel_filter_installed = false;
+  for (int* fd : { &_socket_fd,
+                   &_rx_epoll_fd,
+                   &_tx_epoll_fd,
+                   &_tx_event_fd,
+                   &_stop_event_fd,
+                   &_timer_fd }) {
+    if (*fd >= 0) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+bool
+SocketCanBus::supports_fd() const
+{
+  return _running && _fd_enabled;
+}
+
+Status
+SocketCanBus::send(const CanFrame& frame)
+{
+  if (!_running) {
+    return Status::IOError("CAN socket is not open"_status);
+  }
+  if (frame.is_fd && !_fd_enabled) {
+    return Status::NotImplemented("CAN FD is not enabled on the CAN interface"_status);
+  }
+  // to_socket_frame() would cut the data to what the frame format carries
+  if (frame.size > (frame.is_fd ? CAN_FD_MAX_DATA_LENGTH : CAN_MAX_DATA_LENGTH)) {
+    return Status::Invalid("CAN frame data is too long for its frame format"_status);
+  }
+  std::lock_guard<std::mutex> lock(_tx_mutex);
+  // checked again under the lock, close_can() detaches the loop and closes the eventfd
+  // under it, so both stay valid until the notification below is done
+  if (!_running) {
+    return Status::IOError("CAN socket is not open"_status);
+  }
+  if (_tx_count == _tx_queue.size()) {
+    return Status::CapacityError("CAN TX queue is full"_status);
+  }
+  _tx_queue[(_tx_head + _tx_count) % _tx_queue.size()] = frame;
+  // the TX side drains the whole queue on every wake up, so it is enough to notify it
+  // only when the queue becomes non empty, both notifications are a non blocking
+  // eventfd write
+  if (_tx_count++ == 0) {
+    if (_io_uring_loop) {
+      _io_uring_loop->wake();
+    } else {
+      event_fd_signal(_tx_event_fd);
+    }
+  }
+  return Status::OK();
+}
+
+size_t
+SocketCanBus::take_tx_frames(CanFrame* frames, size_t max_count)
+{
+  std::lock_guard<std::mutex> lock(_tx_mutex);
+  size_t count = std::min(max_count, _tx_count);
+  for (size_t i = 0; i < count; ++i) {
+    frames[i] = _tx_queue[_tx_head];
+    _tx_head = (_tx_head + 1) % _tx_queue.size();
+  }
+  _tx_count -= count;
+  return count;
+}
+
+Result<CanFrame>
+SocketCanBus::send_await_response(const CanFrame& frame,
+                                  uint32_t response_id,
+                                  uint32_t timeout_ms)
+{
+  struct SyncResponse
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::optional<Result<CanFrame>> result;
+  };
+  // shared with the handler, which may still run after we gave up waiting
+  auto response = std::make_shared<SyncResponse>();
+  ARI_RETURN_ON_ERROR(send_await_response_async(
+    frame,
+    response_id,
+    timeout_ms,
+    response_handler_type([response](Result<CanFrame> result) {
+      std::lock_guard<std::mutex> lock(response->mutex);
+      response->result.emplace(std::move(result));
+      response->cv.notify_one();
+    })));
+
+  std::unique_lock<std::mutex> lock(response->mutex);
+  // the timerfd completes the request on time, the own timeout only matters when the
+  // RX side can not run it, e.g. when called from a callback
+  bool done = response->cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] {
+    return response->result.has_value();
+  });
+  if (!done) {
+    return Status::TimeOut("No response received for the CAN frame"_status);
+  }
+  return std::move(*response->result);
+}
+
+Status
+SocketCanBus::send_await_response_async(const CanFrame& frame,
+                                        uint32_t response_id,
+                                        uint32_t timeout_ms,
+                                        response_handler_type handler)
+{
+  if (!handler) {
+    return Status::Invalid("Response handler can not be empty"_status);
+  }
+  return submit_request(
+    frame, response_id, timeout_ms, PendingHandler{ std::move(handler), {} });
+}
+
+Status
+SocketCanBus::send_await_response_stream_async(const CanFrame& frame,
+                                               uint32_t response_id,
+                                               uint32_t timeout_ms,
+                                               response_stream_handler_type handler)
+{
+  if (!handler) {
+    return Status::Invalid("Response handler can not be empty"_status);
+  }
+  return submit_request(
+    frame, response_id, timeout_ms, PendingHandler{ {}, std::move(handler) });
+}
+
+Status
+SocketCanBus::submit_request(const CanFrame& frame,
+                             uint32_t response_id,
+                             uint32_t timeout_ms,
+                             PendingHandler handler)
+{
+  uint64_t now_tick = request_tick_now();
+  uint64_t handle;
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    // checked under the lock, close_can() cancels the requests after clearing it
+    if (!_running) {
+      return Status::IOError("CAN socket is not open"_status);
+    }
+    // the request is registered before sending so a fast response can not be missed,
+    // one tick is added so a partially elapsed tick never shortens the timeout
+    handle = _pending.insert(
+      response_id, now_tick + timeout_ms + 1, now_tick, std::move(handler));
+    if (handle == PendingTable::k_invalid_handle) {
+      return Status::CapacityError("Too many distinct response IDs are awaited"_status);
+    }
+    _pending_count = _pending.size();
+    uint64_t next_tick = _pending.next_expiry_tick();
+    if (next_tick < _timer_tick) {
+      arm_request_timer(next_tick);
+    }
+  }
+  widen_kernel_filter(response_id);
+
+  Status status = send(frame);
+  if (!status.ok()) {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    if (!_pending.erase(handle)) {
+      // already completed by an unrelated frame (CAN_ANY_FRAME), the handler ran
+      return Status::OK();
+    }
+    _pending_count = _pending.size();
+  }
+  return status;
+}
+
+uint64_t
+SocketCanBus::request_tick_now()
+{
+  // steady_clock is CLOCK_MONOTONIC, the clock of the timerfd
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 std::chrono::steady_clock::now().time_since_epoch())
+                                 .count());
+}
+
+void
+SocketCanBus::arm_request_timer(uint64_t tick)
+{
+  _timer_tick = tick;
+  if (_timer_fd < 0) {
+    return;
+  }
+  itimerspec spec{};
+  if (tick != PendingTable::k_no_expiry) {
+    // an absolute time of zero would disarm the timer
+    tick = std::max<uint64_t>(tick, 1);
+    spec.it_value.tv_sec = static_cast<time_t>(tick / 1000);
+    spec.it_value.tv_nsec = static_cast<long>(tick % 1000 * 1000000);
+  }
+  timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void
+SocketCanBus::expire_requests()
+{
+  event_fd_clear(_timer_fd);
+  uint64_t now_tick = request_tick_now();
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    _pending.expire(now_tick, [this](PendingHandler&& handler) {
+      Status timeout = Status::TimeOut("No response received for the CAN frame"_status);
+      _completed_requests.push_back(CompletedRequest{ std::move(handler), timeout });
+    });
+    _pending_count = _pending.size();
+    // the wheel may only know the next block of ticks to cascade, the timer then fires
+    // once more without expiring anything
+    arm_request_timer(_pending.next_expiry_tick());
+  }
+  run_completed_requests();
+}
+
+void
+SocketCanBus::cancel_requests(const Status& status)
+{
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    _pending.take_all([&](PendingHandler&& handler) {
+      _completed_requests.push_back(CompletedRequest{ std::move(handler), status });
+    });
+    _pending_count = 0;
+    _timer_tick = PendingTable::k_no_expiry;
+  }
+  run_completed_requests();
+}
+
+void
+SocketCanBus::run_completed_requests()
+{
+  for (CompletedRequest& completed : _completed_requests) {
+    if (completed.handler.once) {
+      completed.handler.once(std::move(completed.result));
+      continue;
+    }
+    if (completed.stream_handle == PendingTable::k_invalid_handle) {
+      // the stream timed out or was cancelled
+      (void)completed.handler.stream(std::move(completed.result));
+      continue;
+    }
+    // frames matched in the same batch after the handler had enough go back to
+    // dispatch(), the next request for the ID gets them
+    if (std::find(_finished_streams.begin(),
+                  _finished_streams.end(),
+                  completed.stream_handle) != _finished_streams.end()) {
+      _unclaimed_frames.push_back(completed.result.valueOrDie());
+      continue;
+    }
+    if (!completed.handler.stream(std::move(completed.result))) {
+      _finished_streams.push_back(completed.stream_handle);
+      std::lock_guard<std::mutex> lock(_pending_mutex);
+      _pending.erase(completed.stream_handle);
+      _pending_count = _pending.size();
+    }
+  }
+  _completed_requests.clear();
+  _finished_streams.clear();
+}
+
+Status
+SocketCanBus::add_callback(uint32_t id, can_callback_type callback, void* args)
+{
+  if (!callback) {
+    return Status::Invalid("Callback can not be empty"_status);
+  }
+  return add_callback(id, can_delegate_type(std::move(callback)), args);
+}
+
+Status
+SocketCanBus::add_callback(uint32_t id, can_delegate_type callback, void* args)
+{
+  if (!callback) {
+    return Status::Invalid("Callback can not be empty"_status);
+  }
+  bool inserted = _callbacks.update([&](CallbackTable& table) {
+    return table.exact.insert_or_assign(id, CallbackEntry{ std::move(callback), args });
+  });
+  if (!inserted) {
+    return Status::CapacityError("Too many callbacks registered"_status);
+  }
+  update_kernel_filter();
+  return Status::OK();
+}
+
+Status
+SocketCanBus::add_callback_masked(uint32_t id_base,
+                                  uint32_t id_mask,
+                                  can_callback_type callback,
+                                  void* args)
+{
+  if (!callback) {
+    return Status::Invalid("Callback can not be empty"_status);
+  }
+  return add_callback_masked(
+    id_base, id_mask, can_delegate_type(std::move(callback)), args);
+}
+
+Status
+SocketCanBus::add_callback_masked(uint32_t id_base,
+                                  uint32_t id_mask,
+                                  can_delegate_type callback,
+                                  void* args)
+{
+  if (!callback) {
+    return Status::Invalid("Callback can not be empty"_status);
+  }
+  _callbacks.update([&](CallbackTable& table) {
+    table.masked.insert_or_assign(
+      id_base, id_mask, CallbackEntry{ std::move(callback), args });
+    return true;
+  });
+  update_kernel_filter();
+  return Status::OK();
+}
+
+Status
+SocketCanBus::remove_callback(uint32_t id)
+{
+  if (!_callbacks.update([id](CallbackTable& table) { return table.exact.erase(id); })) {
+    return Status::KeyError("No callback registered for this CAN ID"_status);
+  }
+  update_kernel_filter();
+  return Status::OK();
+}
+
+Status
+SocketCanBus::remove_callback_masked(uint32_t id_base, uint32_t id_mask)
+{
+  bool erased = _callbacks.update(
+    [&](CallbackTable& table) { return table.masked.erase(id_base, id_mask); });
+  if (!erased) {
+    return Status::KeyError(
+      "No masked callback registered for this CAN ID and mask"_status);
+  }
+  update_kernel_filter();
+  return Status::OK();
+}
+
+void
+SocketCanBus::update_kernel_filter()
+{
+  if (!_config.kernel_filtering) {
+    return;
+  }
+  std::lock_guard<std::mutex> filter_lock(_filter_mutex);
+
+  auto table = _callbacks.read();
+  _callback_filters.clear();
+  _callback_filters.reserve(table->exact.size() + table->masked.size());
+  table->exact.for_each([this](uint32_t id, const CallbackEntry&) {
+    _callback_filters.push_back(KernelFilter{ id & k_filter_id_bits, k_filter_id_bits });
+  });
+  table->masked.for_each(
+    [this](uint32_t id_base, uint32_t id_mask, const CallbackEntry&) {
+      uint32_t mask = id_mask & k_filter_id_bits;
+      _callback_filters.push_back(KernelFilter{ id_base & mask, mask });
+    });
+  if (_socket_fd >= 0) {
+    rebuild_kernel_filter();
+  }
+}
+
+void
+SocketCanBus::widen_kernel_filter(uint32_t response_id)
+{
+  if (!_config.kernel_filtering) {
+    return;
+  }
+  KernelFilter wanted{ response_id & k_filter_id_bits, k_filter_id_bits };
+  if (response_id == CAN_ANY_FRAME) {
+    wanted = KernelFilter{ 0, 0 };
+  }
+  std::lock_guard<std::mutex> filter_lock(_filter_mutex);
+  if (_socket_fd < 0) {
+    return;
+  }
+  if (_kernel_filter_installed) {
+    // completed requests stay in the filter until the next rebuild, so repeated requests
+    // for the same response ID usually end here without a syscall
+    auto covers = [&wanted](const KernelFilter& filter) {
+      return (filter.mask & wanted.mask) == filter.mask &&
+             (wanted.id & filter.mask) == filter.id;
+    };
+    if (std::any_of(_kernel_filter.begin(), _kernel_filter.end(), covers)) {
+      return;
+    }
+    if (wanted.mask != 0 && _kernel_filter.size() < CAN_RAW_FILTER_MAX) {
+      std::vector<KernelFilter> filters = _kernel_filter;
+      filters.push_back(wanted);
+      install_kernel_filter(std::move(filters));
+      return;
+    }
+  }
+  rebuild_kernel_filter();
+}
+
+void
+SocketCanBus::rebuild_kernel_filter()
+{
+  std::vector<KernelFilter> filters = _callback_filters;
+  bool accept_all = false;
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    filters.reserve(filters.size() + _pending.size());
+    _pending.for_each_response_id([&](uint32_t response_id) {
+      accept_all |= response_id == CAN_ANY_FRAME;
+      filters.push_back(KernelFilter{ response_id & k_filter_id_bits, k_filter_id_bits });
+    });
+  }
+  // a mask without any bits (e.g. a masked callback listening to everything) accepts
+  // every frame just like a request for any frame does
+  accept_all |= std::any_of(
+    filters.begin(), filters.end(), [](const KernelFilter& f) { return f.mask == 0; });
+  if (accept_all) {
+    filters.assign(1, KernelFilter{ 0, 0 });
+  } else {
+    std::sort(filters.begin(), filters.end(), [](const auto& a, const auto& b) {
+      return a.id != b.id ? a.id < b.id : a.mask < b.mask;
+    });
+    filters.erase(std::unique(filters.begin(), filters.end()), filters.end());
+    merge_filters(filters, k_kernel_filter_limit);
+  }
+  install_kernel_filter(std::move(filters));
+}
+
+void
+SocketCanBus::install_kernel_filter(std::vector<KernelFilter>&& filters)
+{
+  // the filter often comes out unchanged, e.g. when a callback is replaced or its ID is
+  // merged into a wider filter already, skip the syscall then
+  if (_kernel_filter_installed && filters == _kernel_filter) {
+    return;
+  }
+  std::vector<can_filter> raw(filters.size());
+  for (size_t i = 0; i < filters.size(); ++i) {
+    raw[i].can_id = filters[i].id;
+    raw[i].can_mask = filters[i].mask;
+  }
+  // an empty filter list makes the kernel drop every frame, which is what we want when
+  // nobody listens
+  int ret = setsockopt(_socket_fd,
+                       SOL_CAN_RAW,
+                       CAN_RAW_FILTER,
+                       raw.empty() ? nullptr : raw.data(),
+                       static_cast<socklen_t>(raw.size() * sizeof(can_filter)));
+  if (ret < 0) {
+    // fall back to receiving everything, filtering in user space still works
+    can_filter all{ 0, 0 };
+    (void)setsockopt(_socket_fd, SOL_CAN_RAW, CAN_RAW_FILTER, &all, sizeof(all));
+    filters.assign(1, KernelFilter{ 0, 0 });
+  }
+  _kernel_filter = std::move(filters);
+  _kernel_filter_installed = true;
+}
+
+void
+SocketCanBus::rx_loop()
+{
+  using Clock = std::chrono::steady_clock;
+  t_rx_thread_bus = this;
+  epoll_event events[k_max_epoll_events];
+  int retry_ms = 0;
+  // when the socket goes back into the epoll set after an error, max() while it is in
+  auto retry_at = Clock::time_point::max();
+  while (_running) {
+    int timeout_ms = -1;
+    if (retry_at != Clock::time_point::max()) {
+      auto left = std::chrono::ceil<std::chrono::milliseconds>(retry_at - Clock::now());
+      timeout_ms = static_cast<int>(std::max<int64_t>(left.count(), 0));
+    }
+    int count = epoll_wait(_rx_epoll_fd, events, k_max_epoll_events, timeout_ms);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (retry_at != Clock::time_point::max() && Clock::now() >= retry_at) {
+      retry_at = Clock::time_point::max();
+      epoll_add(_rx_epoll_fd, _socket_fd, EPOLLIN);
+    }
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.fd == _stop_event_fd) {
+        return;
+      }
+      if (events[i].data.fd == _timer_fd) {
+        expire_requests();
+      }
+      if (events[i].data.fd != _socket_fd) {
+        continue;
+      }
+      int error = read_frames();
+      if (error == 0) {
+        retry_ms = 0;
+        continue;
+      }
+      if (retry_ms == 0) {
+        report_rx_error(error);
+      }
+      // the socket leaves the epoll set for the back off, it would keep reporting
+      // EPOLLERR otherwise, the timerfd of the requests is still served meanwhile
+      retry_ms = std::clamp(retry_ms * 2, k_rx_retry_min_ms, k_rx_retry_max_ms);
+      retry_at = Clock::now() + std::chrono::milliseconds(retry_ms);
+      epoll_ctl(_rx_epoll_fd, EPOLL_CTL_DEL, _socket_fd, nullptr);
+    }
+  }
+}
+
+void
+SocketCanBus::report_rx_error(int error)
+{
+  if (_config.rx_error_handler) {
+    _config.rx_error_handler(
+      Status::IOError(errno_message("Failed to receive CAN frames", error)));
+  }
+}
+
+int
+SocketCanBus::read_frames()
+{
+  // drain everything the kernel has buffered, epoll is level triggered so if we stop
+  // early we will simply be woken up again
+  IoBatch& batch = *_rx_batch;
+  while (true) {
+    batch.reset();
+    int ret = recvmmsg(_socket_fd,
+                       batch.messages.data(),
+                       static_cast<unsigned int>(batch.messages.size()),
+                       MSG_DONTWAIT,
+                       nullptr);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : errno;
+    }
+    size_t count = 0;
+    for (int i = 0; i < ret; ++i) {
+      const mmsghdr& message = batch.messages[i];
+      if (from_socket_frame(batch.raw[i], message.msg_len, batch.frames[count])) {
+        ++count;
+      }
+    }
+    dispatch(batch.frames.data(), count);
+    // a partial batch means the socket is empty, skip the syscall that would return
+    // EAGAIN
+    if (static_cast<size_t>(ret) < batch.messages.size()) {
+      return 0;
+    }
+  }
+}
+
+void
+SocketCanBus::match_requests(const CanFrame* frames, size_t count)
+{
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    for (size_t i = 0; i < count && !_pending.empty(); ++i) {
+      // one frame answers the oldest request waiting for it
+      uint64_t handle = _pending.find_match(frames[i].id);
+      if (handle == PendingTable::k_invalid_handle) {
+        continue;
+      }
+      CanFrame response = frames[i];
+      if (_pending.handler(handle).stream) {
+        _completed_requests.push_back(CompletedRequest{
+          _pending.handler(handle), Result<CanFrame>::OK(std::move(response)), handle });
+      } else {
+        _completed_requests.push_back(CompletedRequest{
+          _pending.take(handle), Result<CanFrame>::OK(std::move(response)) });
+      }
+    }
+    _pending_count = _pending.size();
+  }
+  run_completed_requests();
+}
+
+void
+SocketCanBus::dispatch(const CanFrame* frames, size_t count)
+{
+  if (count == 0) {
+    return;
+  }
+  if (_pending_count.load() != 0) {
+    match_requests(frames, count);
+    while (!_unclaimed_frames.empty() && _pending_count.load() != 0) {
+      _rematched_frames.swap(_unclaimed_frames);
+      _unclaimed_frames.clear();
+      match_requests(_rematched_frames.data(), _rematched_frames.size());
+    }
+    _unclaimed_frames.clear();
+  }
+
+  auto table = _callbacks.read();
+  for (size_t i = 0; i < count; ++i) {
+    const CanFrame& frame = frames[i];
+    // regular callbacks have priority over masked ones
+    if (const CallbackEntry* entry = table->exact.find(frame.id)) {
+      entry->callback(*this, frame, entry->args);
+      continue;
+    }
+    if (const CallbackEntry* entry = table->masked.match(frame.id)) {
+      entry->callback(*this, frame, entry->args);
+    }
+  }
+}
+
+void
+SocketCanBus::tx_loop()
+{
+  epoll_event events[k_max_epoll_events];
+  bool waiting_for_socket = false;
+  int timeout_ms = -1;
+  while (_running) {
+    int count = epoll_wait(_tx_epoll_fd, events, k_max_epoll_events, timeout_ms);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.fd == _stop_event_fd) {
+        return;
+      }
+      if (events[i].data.fd == _tx_event_fd) {
+        event_fd_clear(_tx_event_fd);
+      }
+    }
+
+    int error = write_frames();
+    timeout_ms = error == ENOBUFS ? k_tx_retry_ms : -1;
+    bool need_socket = error != 0 && error != ENOBUFS;
+    if (need_socket != waiting_for_socket) {
+      epoll_modify(_tx_epoll_fd, _socket_fd, need_socket ? uint32_t{ EPOLLOUT } : 0u);
+      waiting_for_socket = need_socket;
+    }
+  }
+}
+
+int
+SocketCanBus::write_frames()
+{
+  IoBatch& batch = *_tx_batch;
+  while (true) {
+    size_t count = 0;
+    batch.reset();
+    {
+      std::lock_guard<std::mutex> lock(_tx_mutex);
+      count = std::min(_tx_count, batch.messages.size());
+      for (size_t i = 0; i < count; ++i) {
+        batch.iovecs[i].iov_len =
+          to_socket_frame(_tx_queue[(_tx_head + i) % _tx_queue.size()], batch.raw[i]);
+      }
+    }
+    if (count == 0) {
+      return 0;
+    }
+    int ret = sendmmsg(
+      _socket_fd, batch.messages.data(), static_cast<unsigned int>(count), MSG_DONTWAIT);
+    size_t sent;
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+        // keep the frames in the queue and retry once the socket can take them
+        return errno;
+      }
+      // the first frame can not be sent at all (e.g. interface is down), drop it so the
+      // queue does not get stuck on it
+      sent = 1;
+    } else {
+      sent = static_cast<size_t>(ret);
+    }
+    std::lock_guard<std::mutex> lock(_tx_mutex);
+    _tx_head = (_tx_head + sent) % _tx_queue.size();
+    _tx_count -= sent;
+  }
+}
+
+} // namespace mcan
+
+#endif // __linux__
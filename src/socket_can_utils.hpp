@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+/*
+ * Helpers shared by the SocketCAN I/O backends, not part of the public interface.
+ */
+
+#pragma once
+
+#include "can_base.hpp"
+#include "mc_common.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/can.h>
+#include <string>
+#include <unistd.h>
+
+namespace mcan::detail {
+
+inline std::string
+errno_message(const char* what, int error = errno)
+{
+  return std::string(what) + ": " + std::strerror(error);
+}
+
+/// @brief Convert a frame to the SocketCAN layout.
+/// @return number of bytes to write, CAN_MTU for classic frames and CANFD_MTU for CAN FD
+/// frames.
+inline size_t
+to_socket_frame(const CanFrame& frame, canfd_frame& out)
+{
+  std::memset(&out, 0, sizeof(out));
+  if (frame.is_extended) {
+    out.can_id = (frame.id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  } else {
+    out.can_id = frame.id & CAN_SFF_MASK;
+  }
+  if (frame.is_fd) {
+    // CAN FD has no remote frames, the unused data bytes of the padding stay zero
+    out.len = can_dlc_to_length(can_length_to_dlc(frame.size, true), true);
+    out.flags = (frame.bit_rate_switch ? CANFD_BRS : 0) |
+                (frame.error_state_indicator ? CANFD_ESI : 0);
+    std::memcpy(out.data, frame.data, std::min<size_t>(frame.size, CANFD_MAX_DLEN));
+    return CANFD_MTU;
+  }
+  if (frame.is_remote_request) {
+    out.can_id |= CAN_RTR_FLAG;
+  }
+  out.len = frame.size > CAN_MAX_DLEN ? CAN_MAX_DLEN : frame.size;
+  if (!frame.is_remote_request) {
+    std::memcpy(out.data, frame.data, out.len);
+  }
+  return CAN_MTU;
+}
+
+/// @brief Convert a frame read from the socket.
+/// @param size Number of bytes read, CAN_MTU or CANFD_MTU.
+/// @return false for error frames and reads of unexpected size.
+inline bool
+from_socket_frame(const canfd_frame& in, size_t size, CanFrame& frame)
+{
+  if ((size != CAN_MTU && size != CANFD_MTU) || (in.can_id & CAN_ERR_FLAG)) {
+    return false;
+  }
+  frame.is_fd = size == CANFD_MTU;
+  frame.is_extended = (in.can_id & CAN_EFF_FLAG) != 0;
+  frame.is_remote_request = !frame.is_fd && (in.can_id & CAN_RTR_FLAG) != 0;
+  frame.id = in.can_id & (frame.is_extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+  // remote requests are identified by the flag in the ID, the same way they are sent
+  if (frame.is_remote_request) {
+    frame.id |= CAN_REMOTE_REQUEST_FLAG;
+  }
+  frame.bit_rate_switch = frame.is_fd && (in.flags & CANFD_BRS);
+  frame.error_state_indicator = frame.is_fd && (in.flags & CANFD_ESI);
+  uint8_t max_length = frame.is_fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+  frame.size = in.len > max_length ? max_length : in.len;
+  std::memcpy(frame.data, in.data, frame.size);
+  return true;
+}
+
+inline void
+event_fd_signal(int fd)
+{
+  uint64_t one = 1;
+  [[maybe_unused]] ssize_t ret = write(fd, &one, sizeof(one));
+}
+
+inline void
+event_fd_clear(int fd)
+{
+  uint64_t value;
+  [[maybe_unused]] ssize_t ret = read(fd, &value, sizeof(value));
+}
+
+} // namespace mcan::detail
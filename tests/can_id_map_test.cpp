@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * CanIdMap: IDs on both sides of a page boundary, erase and reuse of values, the table
+ * of pages growing, the capacity limit and random changes against std::map.
+ */
+
+#include "can_id_map.hpp"
+#include "test_util.hpp"
+#include <cstdint>
+#include <map>
+#include <random>
+
+using namespace mcan;
+
+namespace {
+
+void
+test_page_boundaries()
+{
+  CanIdMap<int> map;
+  // the last node of one unique id, the first node of the next and the same node with
+  // the remote request flag all live on different pages
+  const uint32_t last = 0x1234FF;
+  const uint32_t next = 0x123500;
+  const uint32_t rtr = 0x400000FF | last;
+  MCAN_CHECK(map.insert_or_assign(last, 1));
+  MCAN_CHECK(map.insert_or_assign(next, 2));
+  MCAN_CHECK(map.insert_or_assign(rtr, 3));
+  MCAN_CHECK(map.insert_or_assign(0, 4));
+  MCAN_CHECK(map.size() == 4);
+  MCAN_CHECK(*map.find(last) == 1);
+  MCAN_CHECK(*map.find(next) == 2);
+  MCAN_CHECK(*map.find(rtr) == 3);
+  MCAN_CHECK(*map.find(0) == 4);
+  MCAN_CHECK(map.find(last - 1) == nullptr);
+  MCAN_CHECK(map.find(next + 1) == nullptr);
+  MCAN_CHECK(map.find(0x1FFFFFFF) == nullptr);
+}
+
+void
+test_erase_and_reuse()
+{
+  CanIdMap<int> map;
+  MCAN_CHECK(!map.erase(0x100));
+  MCAN_CHECK(map.insert_or_assign(0x100, 1));
+  MCAN_CHECK(map.insert_or_assign(0x100, 2));
+  MCAN_CHECK(map.size() == 1 && *map.find(0x100) == 2);
+  MCAN_CHECK(map.erase(0x100));
+  MCAN_CHECK(!map.erase(0x100));
+  MCAN_CHECK(map.find(0x100) == nullptr && map.empty());
+  // the page and the value slot are reused
+  MCAN_CHECK(map.insert_or_assign(0x101, 3));
+  MCAN_CHECK(*map.find(0x101) == 3 && map.find(0x100) == nullptr);
+  size_t visited = 0;
+  map.for_each([&](uint32_t id, int value) {
+    MCAN_CHECK(id == 0x101 && value == 3);
+    ++visited;
+  });
+  MCAN_CHECK(visited == 1);
+}
+
+void
+test_many_unique_ids_and_capacity()
+{
+  CanIdMap<uint32_t> map;
+  // 65535 values on 301 unique ids, the page table rehashes several times
+  uint32_t count = 0;
+  for (uint32_t unique = 0; count < 0xFFFF; ++unique) {
+    for (uint32_t node = 0; node < 218 && count < 0xFFFF; ++node, ++count) {
+      MCAN_CHECK(map.insert_or_assign(unique << 8 | node, unique << 8 | node));
+    }
+  }
+  MCAN_CHECK(map.size() == 0xFFFF);
+  MCAN_CHECK(!map.insert_or_assign(0x1FFFFF00, 0));
+  MCAN_CHECK(map.insert_or_assign(0x100, 7));
+  MCAN_CHECK(*map.find(0x100) == 7);
+  MCAN_CHECK(*map.find(299u << 8 | 200) == (299u << 8 | 200));
+  MCAN_CHECK(map.erase(0x100));
+  MCAN_CHECK(map.insert_or_assign(0x1FFFFF00, 0));
+  MCAN_CHECK(map.find(0x1FFFFF00) != nullptr);
+}
+
+void
+test_random_changes_match_std_map()
+{
+  std::mt19937 generator(3);
+  CanIdMap<uint32_t> map;
+  std::map<uint32_t, uint32_t> reference;
+  for (uint32_t step = 0; step < 50000; ++step) {
+    // few unique ids and nodes near the page boundary, so ids collide often
+    uint32_t id = (0x1000 + generator() % 40) << 8 | (generator() % 8 + 0xFC) % 0x100;
+    if (generator() % 3 == 0) {
+      MCAN_CHECK(map.erase(id) == (reference.erase(id) == 1));
+    } else {
+      MCAN_CHECK(map.insert_or_assign(id, step));
+      reference[id] = step;
+    }
+    uint32_t probe = (0x1000 + generator() % 40) << 8 | (generator() % 8 + 0xFC) % 0x100;
+    auto it = reference.find(probe);
+    const uint32_t* found = map.find(probe);
+    MCAN_CHECK((found == nullptr) == (it == reference.end()));
+    if (found != nullptr && it != reference.end()) {
+      MCAN_CHECK(*found == it->second);
+    }
+  }
+  MCAN_CHECK(map.size() == reference.size());
+  size_t visited = 0;
+  map.for_each([&](uint32_t id, uint32_t value) {
+    MCAN_CHECK(reference.count(id) == 1 && reference[id] == value);
+    ++visited;
+  });
+  MCAN_CHECK(visited == reference.size());
+}
+
+} // namespace
+
+int
+main()
+{
+  test_page_boundaries();
+  test_erase_and_reuse();
+  test_many_unique_ids_and_capacity();
+  test_random_changes_match_std_map();
+  return mcan::test::finish();
+}
@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * InlineDelegate: trivially copyable callables and callables that own heap memory (a
+ * shared_ptr capture, a std::function) copied, moved and destroyed, and empty delegates
+ * made from a null function pointer, an empty std::function or an empty delegate.
+ */
+
+#include "inline_delegate.hpp"
+#include "test_util.hpp"
+#include <functional>
+#include <memory>
+#include <utility>
+
+using namespace mcan;
+
+namespace {
+
+using Delegate = InlineDelegate<int(int), 6 * sizeof(void*)>;
+
+int
+twice(int value)
+{
+  return value * 2;
+}
+
+void
+test_trivial_callables()
+{
+  int offset = 5;
+  Delegate add([&offset](int value) { return value + offset; });
+  Delegate copy(add);
+  offset = 7;
+  MCAN_CHECK(add(1) == 8 && copy(1) == 8);
+  Delegate moved(std::move(add));
+  MCAN_CHECK(moved(2) == 9 && !add);
+  Delegate function(twice);
+  Delegate pointer(&twice);
+  MCAN_CHECK(function(4) == 8 && pointer(5) == 10);
+  copy = function;
+  MCAN_CHECK(copy(6) == 12);
+}
+
+void
+test_callables_owning_memory()
+{
+  auto owned = std::make_shared<int>(3);
+  {
+    Delegate scaled([owned](int value) { return value * *owned; });
+    MCAN_CHECK(owned.use_count() == 2);
+    Delegate copy(scaled);
+    MCAN_CHECK(owned.use_count() == 3 && copy(2) == 6);
+    Delegate moved(std::move(scaled));
+    MCAN_CHECK(owned.use_count() == 3 && !scaled && moved(3) == 9);
+    // assigning over a managed callable destroys it
+    copy = Delegate(twice);
+    MCAN_CHECK(owned.use_count() == 2 && copy(3) == 6);
+    moved = moved;
+    MCAN_CHECK(owned.use_count() == 2 && moved(1) == 3);
+    moved = nullptr;
+    MCAN_CHECK(owned.use_count() == 1 && !moved);
+  }
+  std::function<int(int)> function = [owned](int value) { return value + *owned; };
+  Delegate wrapped(function);
+  MCAN_CHECK(owned.use_count() == 3 && wrapped(1) == 4);
+  wrapped = Delegate();
+  MCAN_CHECK(owned.use_count() == 2);
+}
+
+void
+test_empty_callables_make_empty_delegates()
+{
+  MCAN_CHECK(!Delegate());
+  int (*null_function)(int) = nullptr;
+  MCAN_CHECK(!Delegate(null_function));
+  MCAN_CHECK(!Delegate(std::function<int(int)>()));
+  MCAN_CHECK(!Delegate(InlineDelegate<int(int)>()));
+  MCAN_CHECK(Delegate(InlineDelegate<int(int)>(twice))(2) == 4);
+  Delegate empty(null_function);
+  Delegate copy(empty);
+  MCAN_CHECK(!copy);
+}
+
+} // namespace
+
+int
+main()
+{
+  test_trivial_callables();
+  test_callables_owning_memory();
+  test_empty_callables_make_empty_delegates();
+  return mcan::test::finish();
+}
@@ -0,0 +1,157 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * MaskedIdMatcher against a linear reference under random inserts, replacements and
+ * removals, and the priority of masks: more bits first, then registration order.
+ */
+
+#include "masked_id_matcher.hpp"
+#include "test_util.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace mcan;
+
+namespace {
+
+struct Filter
+{
+  uint32_t id_base;
+  uint32_t id_mask;
+  int value;
+};
+
+/// @brief The most specific matching filter, the first registered mask on a tie.
+const int*
+reference_match(const std::vector<Filter>& filters,
+                const std::vector<uint32_t>& mask_order,
+                uint32_t id)
+{
+  const Filter* best = nullptr;
+  size_t best_order = 0;
+  for (const Filter& filter : filters) {
+    if ((id & filter.id_mask) != filter.id_base) {
+      continue;
+    }
+    size_t order = static_cast<size_t>(
+      std::find(mask_order.begin(), mask_order.end(), filter.id_mask) -
+      mask_order.begin());
+    if (best == nullptr || std::popcount(filter.id_mask) > std::popcount(best->id_mask) ||
+        (std::popcount(filter.id_mask) == std::popcount(best->id_mask) &&
+         order < best_order)) {
+      best = &filter;
+      best_order = order;
+    }
+  }
+  return best ? &best->value : nullptr;
+}
+
+void
+test_random_changes_match_reference()
+{
+  // 0xFF0 and 0x0FF are equally specific, the one registered first wins
+  const std::array<uint32_t, 4> masks{ 0xFFF, 0xFF0, 0x0FF, 0xF00 };
+  std::mt19937 generator(7);
+  MaskedIdMatcher<int> matcher;
+  std::vector<Filter> filters;
+  std::vector<uint32_t> mask_order;
+  for (int step = 0; step < 20000; ++step) {
+    uint32_t mask = masks[generator() % masks.size()];
+    // few distinct bases, so filters are replaced and removed often
+    uint32_t id_base = (generator() % 64) * 0x111u & mask;
+    auto it = std::find_if(filters.begin(), filters.end(), [&](const Filter& f) {
+      return f.id_base == id_base && f.id_mask == mask;
+    });
+    if (generator() % 3 == 0) {
+      MCAN_CHECK(matcher.erase(id_base, mask) == (it != filters.end()));
+      if (it != filters.end()) {
+        filters.erase(it);
+      }
+    } else {
+      matcher.insert_or_assign(id_base, mask, step);
+      if (it != filters.end()) {
+        it->value = step;
+      } else {
+        filters.push_back(Filter{ id_base, mask, step });
+      }
+    }
+    std::erase_if(mask_order, [&](uint32_t m) {
+      return std::none_of(filters.begin(), filters.end(), [m](const Filter& f) {
+        return f.id_mask == m;
+      });
+    });
+    if (std::none_of(mask_order.begin(), mask_order.end(), [mask](uint32_t m) {
+          return m == mask;
+        }) &&
+        std::any_of(filters.begin(), filters.end(), [mask](const Filter& f) {
+          return f.id_mask == mask;
+        })) {
+      mask_order.push_back(mask);
+    }
+    MCAN_CHECK(matcher.size() == filters.size());
+    for (int lookup = 0; lookup < 8; ++lookup) {
+      uint32_t id = generator() & 0xFFF;
+      const int* expected = reference_match(filters, mask_order, id);
+      const int* found = matcher.match(id);
+      MCAN_CHECK((expected == nullptr) == (found == nullptr));
+      if (expected != nullptr && found != nullptr) {
+        MCAN_CHECK(*expected == *found);
+      }
+    }
+  }
+}
+
+void
+test_mask_registered_again_is_ordered_last()
+{
+  MaskedIdMatcher<int> matcher;
+  matcher.insert_or_assign(0x120, 0xFF0, 1);
+  matcher.insert_or_assign(0x023, 0x0FF, 2);
+  MCAN_CHECK(*matcher.match(0x123) == 1);
+  MCAN_CHECK(matcher.erase(0x120, 0xFF0));
+  MCAN_CHECK(!matcher.erase(0x120, 0xFF0));
+  matcher.insert_or_assign(0x120, 0xFF0, 1);
+  MCAN_CHECK(*matcher.match(0x123) == 2);
+  matcher.insert_or_assign(0x123, 0xFFF, 3);
+  MCAN_CHECK(*matcher.match(0x123) == 3);
+  MCAN_CHECK(matcher.match(0x456) == nullptr);
+}
+
+} // namespace
+
+int
+main()
+{
+  test_random_changes_match_reference();
+  test_mask_registered_again_is_ordered_last();
+  return mcan::test::finish();
+}
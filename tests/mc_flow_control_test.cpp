@@ -0,0 +1,182 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Flow controlled transfers against a scripted receiver: lost fragments are sent again,
+ * a receiver that never makes progress ends the transfer, and the two directions of the
+ * handshake use their own identifiers.
+ */
+
+#include "mc_flow_control.hpp"
+#include "test_util.hpp"
+#include <array>
+#include <memory>
+#include <set>
+
+using namespace mcan;
+using mcan::test::TestCan;
+
+namespace {
+
+struct FlowMessage
+{
+  static constexpr uint32_t k_base_address = 0x200;
+  using Type = std::array<uint8_t, 300>;
+  Type value;
+};
+
+constexpr uint8_t k_node_id = 5;
+
+/// @brief Receiver of FlowMessage on the other end of the bus.
+struct Receiver
+{
+  CanMultiPackageFrame<FlowMessage> state{};
+  TestCan bus;
+  // drops the first transmission of the fragments the predicate selects
+  bool (*lose)(size_t index, size_t transmission) = nullptr;
+  std::array<size_t, CanMultiPackageFrame<FlowMessage>::expected_index_count>
+    transmissions{};
+  size_t status_requests = 0;
+  bool complete = false;
+
+  void attach(TestCan& sender)
+  {
+    sender.on_send = [this](const CanFrame& frame) {
+      if (frame.id == mcan_connect_msg_id_with_node_id(0x200, k_node_id)) {
+        const size_t index = frame.data[0];
+        if (lose == nullptr || !lose(index, transmissions[index]++)) {
+          complete |= mcan_unpack_msg(frame, state).ok();
+        }
+      }
+      return Status::OK();
+    };
+    sender.on_request = [this](const CanFrame& request,
+                               uint32_t response_id,
+                               uint32_t) -> Result<CanFrame> {
+      MCAN_CHECK(mcan_is_flow_status_request<FlowMessage>(request));
+      ++status_requests;
+      MCAN_CHECK(mcan_send_flow_status<FlowMessage>(bus, request, state).ok());
+      CanFrame status = bus.sent.back();
+      MCAN_CHECK(status.id == response_id);
+      return Result<CanFrame>::OK(std::move(status));
+    };
+  }
+};
+
+std::unique_ptr<FlowMessage>
+make_message()
+{
+  auto message = std::make_unique<FlowMessage>();
+  for (size_t i = 0; i < message->value.size(); ++i) {
+    message->value[i] = static_cast<uint8_t>(i * 13);
+  }
+  return message;
+}
+
+void
+test_lost_fragments_are_sent_again()
+{
+  TestCan sender;
+  Receiver receiver;
+  receiver.lose = [](size_t index, size_t transmission) {
+    return transmission == 0 && index % 5 == 2;
+  };
+  receiver.attach(sender);
+  auto message = make_message();
+  McanFlowControl flow_control;
+  flow_control.block_size = 8;
+  MCAN_CHECK(
+    mcan_pack_send_msg_flow_controlled(sender, *message, k_node_id, flow_control).ok());
+  MCAN_CHECK(receiver.complete);
+  MCAN_CHECK(receiver.state.value == message->value);
+  // every lost fragment cost one more frame, none was sent a third time
+  const size_t fragments = mcan_transfer_fragment_count<FlowMessage>(false);
+  for (size_t i = 0; i < fragments; ++i) {
+    MCAN_CHECK(receiver.transmissions[i] == (i % 5 == 2 ? 2u : 1u));
+  }
+}
+
+void
+test_stalled_receiver_times_out()
+{
+  TestCan sender;
+  Receiver receiver;
+  receiver.lose = [](size_t, size_t) { return true; };
+  receiver.attach(sender);
+  auto message = make_message();
+  McanFlowControl flow_control;
+  flow_control.max_stalled_rounds = 4;
+  Status status =
+    mcan_pack_send_msg_flow_controlled(sender, *message, k_node_id, flow_control);
+  MCAN_CHECK(status.status_code() == StatusCode::TimeOut);
+  MCAN_CHECK(receiver.status_requests == 4);
+}
+
+void
+test_directions_use_their_own_identifiers()
+{
+  std::set<uint32_t> status_ids;
+  for (uint8_t sender_node_id : { 1, 2 }) {
+    TestCan sender;
+    Receiver receiver;
+    receiver.attach(sender);
+    auto message = make_message();
+    McanFlowControl flow_control;
+    flow_control.sender_node_id = sender_node_id;
+    MCAN_CHECK(
+      mcan_pack_send_msg_flow_controlled(sender, *message, k_node_id, flow_control)
+        .ok());
+    std::set<uint32_t> sender_ids;
+    for (const CanFrame& frame : sender.sent) {
+      sender_ids.insert(frame.id);
+    }
+    MCAN_CHECK(sender_ids.count(mcan_connect_msg_id_with_node_id(
+                 MCAN_FLOW_CONTROL_UID | sender_node_id, k_node_id)) == 1);
+    for (const CanFrame& frame : receiver.bus.sent) {
+      MCAN_CHECK(sender_ids.count(frame.id) == 0);
+      MCAN_CHECK(frame.id == mcan_connect_msg_id_with_node_id(
+                               MCAN_FLOW_STATUS_UID | sender_node_id, k_node_id));
+      status_ids.insert(frame.id);
+    }
+  }
+  // each sender only sees the statuses meant for it
+  MCAN_CHECK(status_ids.size() == 2);
+  static_assert(mcan_is_flow_control_uid(MCAN_FLOW_CONTROL_UID));
+  static_assert(mcan_is_flow_control_uid(MCAN_FLOW_STATUS_UID | 0xFF));
+  static_assert(!mcan_is_flow_control_uid(MCAN_FLOW_CONTROL_UID - 1));
+}
+
+} // namespace
+
+int
+main()
+{
+  test_lost_fragments_are_sent_again();
+  test_stalled_receiver_times_out();
+  test_directions_use_their_own_identifiers();
+  return mcan::test::finish();
+}
@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Must not compile: two messages of a MessageRegistry with the same k_base_address.
+ * The mc_message_registry_duplicate test builds this file and expects the static_assert
+ * of MessageRegistry in the compiler output.
+ */
+
+#include "mc_message_registry.hpp"
+#include <cstdint>
+
+struct First
+{
+  static constexpr uint32_t k_base_address = 0x100;
+  using Type = uint32_t;
+  Type value;
+};
+
+struct Second
+{
+  static constexpr uint32_t k_base_address = 0x100;
+  using Type = uint16_t;
+  Type value;
+};
+
+int
+main()
+{
+  mcan::MessageRegistry<First, Second> registry;
+  (void)registry;
+  return 0;
+}
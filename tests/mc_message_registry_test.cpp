@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * MessageRegistry: the sorted address table and index_of(), dispatch() of single and
+ * multi frame messages, multi frame reassembly through the per message callbacks of
+ * attach(), and a transfer from another node restarting the reassembly.
+ * Registering two messages with the same k_base_address must not compile, see
+ * mc_message_registry_duplicate.cpp, built by the mc_message_registry_duplicate test.
+ */
+
+#include "mc_message_registry.hpp"
+#include "test_util.hpp"
+#include <array>
+#include <vector>
+
+using namespace mcan;
+using mcan::test::TestCan;
+
+namespace {
+
+struct Speed
+{
+  static constexpr uint32_t k_base_address = 0x300;
+  using Type = uint32_t;
+  Type value;
+};
+
+struct Position
+{
+  static constexpr uint32_t k_base_address = 0x100;
+  using Type = std::array<uint8_t, 30>;
+  Type value;
+};
+
+struct Label
+{
+  static constexpr uint32_t k_base_address = 0x200;
+  static constexpr bool k_tagged_transfer = true;
+  using Type = std::array<uint8_t, 20>;
+  Type value;
+};
+
+using Registry = MessageRegistry<Speed, Position, Label>;
+
+static_assert(Registry::k_table[0].base_address == 0x100);
+static_assert(Registry::k_table[1].base_address == 0x200);
+static_assert(Registry::k_table[2].base_address == 0x300);
+static_assert(Registry::index_of(0x300) == 0);
+static_assert(Registry::index_of(0x100) == 1);
+static_assert(Registry::index_of(0x200) == 2);
+static_assert(Registry::index_of(0x000) == Registry::k_not_found);
+static_assert(Registry::index_of(0x250) == Registry::k_not_found);
+static_assert(Registry::index_of(0x1FFFFF) == Registry::k_not_found);
+static_assert(Registry::contains(0x100) && !Registry::contains(0x101));
+
+/// @brief Records what the registry hands out.
+struct Handler
+{
+  std::vector<uint32_t> speeds;
+  std::vector<std::pair<uint8_t, uint8_t>> positions;
+  std::vector<uint8_t> labels;
+
+  void operator()(uint8_t, const Speed& message) { speeds.push_back(message.value); }
+  void operator()(uint8_t node_id, const Position& message)
+  {
+    positions.emplace_back(node_id, message.value[29]);
+  }
+  void operator()(uint8_t, const Label& message) { labels.push_back(message.value[0]); }
+};
+
+/// @brief Bus that keeps the masked callbacks and delivers frames to them.
+class MaskedCan : public TestCan
+{
+ public:
+  using CanBase::add_callback_masked;
+
+  Status add_callback_masked(uint32_t id_base,
+                             uint32_t id_mask,
+                             can_callback_type callback,
+                             void*) override
+  {
+    callbacks.push_back(Callback{ id_base, id_mask, std::move(callback) });
+    return Status::OK();
+  }
+
+  Status remove_callback_masked(uint32_t id_base, uint32_t id_mask) override
+  {
+    std::erase_if(callbacks, [&](const Callback& callback) {
+      return callback.id_base == id_base && callback.id_mask == id_mask;
+    });
+    return Status::OK();
+  }
+
+  void deliver(const CanFrame& frame)
+  {
+    for (Callback& callback : callbacks) {
+      if ((frame.id & callback.id_mask) == callback.id_base) {
+        callback.callback(*this, frame, nullptr);
+      }
+    }
+  }
+
+  struct Callback
+  {
+    uint32_t id_base;
+    uint32_t id_mask;
+    can_callback_type callback;
+  };
+
+  std::vector<Callback> callbacks;
+};
+
+template<typename T>
+std::vector<CanFrame>
+frames_of(uint8_t node_id, uint8_t fill)
+{
+  TestCan can;
+  T message{};
+  if constexpr (std::is_integral_v<typename T::Type>) {
+    message.value = fill;
+  } else {
+    message.value.fill(fill);
+  }
+  MCAN_CHECK(mcan_pack_send_msg(can, message, node_id).ok());
+  return can.sent;
+}
+
+void
+test_dispatch()
+{
+  Registry registry;
+  Handler handler;
+  std::vector<CanFrame> speed = frames_of<Speed>(4, 42);
+  MCAN_CHECK(speed.size() == 1);
+  MCAN_CHECK(registry.dispatch(speed[0], handler).ok());
+  MCAN_CHECK(handler.speeds == std::vector<uint32_t>{ 42 });
+
+  std::vector<CanFrame> label = frames_of<Label>(4, 7);
+  MCAN_CHECK(label.size() > 1);
+  Status status = Status::OK();
+  for (const CanFrame& frame : label) {
+    status = registry.dispatch(frame, handler);
+  }
+  MCAN_CHECK(status.ok() && handler.labels == std::vector<uint8_t>{ 7 });
+
+  CanFrame unknown = speed[0];
+  unknown.id = mcan_connect_msg_id_with_node_id(0x250, 4);
+  MCAN_CHECK(registry.dispatch(unknown, handler).status_code() == StatusCode::KeyError);
+  CanFrame remote = speed[0];
+  remote.is_remote_request = true;
+  MCAN_CHECK(registry.dispatch(remote, handler).status_code() == StatusCode::KeyError);
+  CanFrame short_frame = speed[0];
+  short_frame.size = 2;
+  MCAN_CHECK(registry.dispatch(short_frame, handler).status_code() ==
+             StatusCode::Invalid);
+  MCAN_CHECK(handler.speeds.size() == 1);
+}
+
+void
+test_attach_reassembles_and_restarts_on_other_node()
+{
+  Registry registry;
+  Handler handler;
+  MaskedCan can;
+  MCAN_CHECK(registry.attach(can, handler).ok());
+  MCAN_CHECK(can.callbacks.size() == 3);
+
+  std::vector<CanFrame> first = frames_of<Position>(1, 0x11);
+  std::vector<CanFrame> second = frames_of<Position>(2, 0x22);
+  MCAN_CHECK(first.size() > 2);
+  // node 1 sends half of its transfer, node 2 then starts over with the whole message
+  for (size_t i = 0; i < first.size() / 2; ++i) {
+    can.deliver(first[i]);
+  }
+  for (const CanFrame& frame : second) {
+    can.deliver(frame);
+  }
+  MCAN_CHECK(handler.positions.size() == 1);
+  MCAN_CHECK(handler.positions[0] == std::make_pair(uint8_t{ 2 }, uint8_t{ 0x22 }));
+  // the rest of node 1's transfer does not complete a message of stale and new parts
+  for (size_t i = first.size() / 2; i < first.size(); ++i) {
+    can.deliver(first[i]);
+  }
+  MCAN_CHECK(handler.positions.size() == 1);
+  // a complete transfer from node 1 goes through again
+  for (const CanFrame& frame : first) {
+    can.deliver(frame);
+  }
+  MCAN_CHECK(handler.positions.size() == 2);
+  MCAN_CHECK(handler.positions[1] == std::make_pair(uint8_t{ 1 }, uint8_t{ 0x11 }));
+
+  MCAN_CHECK(registry.detach(can).ok());
+  MCAN_CHECK(can.callbacks.empty());
+}
+
+} // namespace
+
+int
+main()
+{
+  test_dispatch();
+  test_attach_reassembles_and_restarts_on_other_node();
+  return mcan::test::finish();
+}
@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * McanReassembler: interleaved transfers from two nodes, a stalled transfer dropped by
+ * expire() from another thread while fragments keep arriving, and eviction when every
+ * buffer is in use.
+ */
+
+#include "mc_reassembly.hpp"
+#include "test_util.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace mcan;
+using mcan::test::TestCan;
+
+namespace {
+
+struct Telemetry
+{
+  static constexpr uint32_t k_base_address = 0x300;
+  using Type = std::array<uint8_t, 40>;
+  Type value;
+};
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief Fragments of Telemetry filled with the byte, sent by the node.
+std::vector<CanFrame>
+fragments(uint8_t node_id, uint8_t fill)
+{
+  TestCan can;
+  Telemetry message;
+  message.value.fill(fill);
+  MCAN_CHECK(mcan_pack_send_msg(can, message, node_id).ok());
+  return can.sent;
+}
+
+struct Delivered
+{
+  uint8_t node_id;
+  uint8_t fill;
+};
+
+void
+test_interleaved_nodes_and_expiry()
+{
+  std::vector<Delivered> delivered;
+  McanReassembler<Telemetry> reassembler(
+    4, 100, McanReassembler<Telemetry>::callback_type([&](uint8_t node, const auto& v) {
+      delivered.push_back(Delivered{ node, v[0] });
+    }));
+  std::vector<CanFrame> a = fragments(1, 0xA1);
+  std::vector<CanFrame> b = fragments(2, 0xB2);
+  std::vector<CanFrame> stalled = fragments(3, 0xC3);
+  MCAN_CHECK(a.size() > 2 && a.size() == b.size());
+  const Clock::time_point start = Clock::now();
+  // node 3 sends its first fragment only, then the others interleave
+  MCAN_CHECK(reassembler.on_frame(stalled[0], start).status_code() ==
+             StatusCode::Cancelled);
+  for (size_t i = 0; i < a.size(); ++i) {
+    Clock::time_point now = start + std::chrono::milliseconds(10 * (i + 1));
+    (void)reassembler.on_frame(a[i], now);
+    (void)reassembler.on_frame(b[a.size() - 1 - i], now);
+  }
+  MCAN_CHECK(delivered.size() == 2);
+  for (const Delivered& message : delivered) {
+    MCAN_CHECK((message.node_id == 1 && message.fill == 0xA1) ||
+               (message.node_id == 2 && message.fill == 0xB2));
+  }
+  MCAN_CHECK(reassembler.in_progress() == 1);
+  reassembler.expire(start + std::chrono::milliseconds(100));
+  MCAN_CHECK(reassembler.in_progress() == 1);
+  reassembler.expire(start + std::chrono::milliseconds(101));
+  MCAN_CHECK(reassembler.in_progress() == 0);
+  // the rest of the stalled transfer starts a new message that misses its first part
+  for (size_t i = 1; i < stalled.size(); ++i) {
+    (void)reassembler.on_frame(stalled[i], start + std::chrono::milliseconds(110));
+  }
+  MCAN_CHECK(delivered.size() == 2);
+  McanReassemblyStats stats = reassembler.stats();
+  MCAN_CHECK(stats.completed == 2 && stats.timed_out == 1 && stats.evicted == 0);
+}
+
+void
+test_eviction_of_the_oldest()
+{
+  size_t delivered = 0;
+  McanReassembler<Telemetry> reassembler(
+    2, 1000, McanReassembler<Telemetry>::callback_type([&](uint8_t, const auto&) {
+      ++delivered;
+    }));
+  const Clock::time_point start = Clock::now();
+  for (uint8_t node = 1; node <= 3; ++node) {
+    (void)reassembler.on_frame(fragments(node, node)[0],
+                               start + std::chrono::milliseconds(node));
+  }
+  // node 1 was the least recently updated and lost its buffer to node 3
+  std::vector<CanFrame> one = fragments(1, 1);
+  for (size_t i = 1; i < one.size(); ++i) {
+    (void)reassembler.on_frame(one[i], start + std::chrono::milliseconds(5));
+  }
+  MCAN_CHECK(delivered == 0);
+  std::vector<CanFrame> three = fragments(3, 3);
+  for (size_t i = 1; i < three.size(); ++i) {
+    (void)reassembler.on_frame(three[i], start + std::chrono::milliseconds(6));
+  }
+  MCAN_CHECK(delivered == 1);
+  MCAN_CHECK(reassembler.stats().evicted >= 1);
+}
+
+void
+test_expire_from_another_thread()
+{
+  std::atomic<size_t> delivered{ 0 };
+  McanReassembler<Telemetry> reassembler(
+    8, 1, McanReassembler<Telemetry>::callback_type([&](uint8_t, const auto&) {
+      ++delivered;
+    }));
+  std::atomic<bool> stop{ false };
+  std::thread expirer([&] {
+    while (!stop) {
+      reassembler.expire();
+      (void)reassembler.stats();
+    }
+  });
+  std::vector<CanFrame> a = fragments(1, 1);
+  std::vector<CanFrame> b = fragments(2, 2);
+  for (int round = 0; round < 2000; ++round) {
+    for (size_t i = 0; i < a.size(); ++i) {
+      (void)reassembler.on_frame(a[i]);
+      (void)reassembler.on_frame(b[i]);
+    }
+  }
+  stop = true;
+  expirer.join();
+  // a transfer may time out on a slow machine, nothing else may go wrong
+  McanReassemblyStats stats = reassembler.stats();
+  MCAN_CHECK(stats.completed == delivered);
+  MCAN_CHECK(stats.completed + stats.timed_out > 0);
+  MCAN_CHECK(stats.evicted == 0);
+}
+
+} // namespace
+
+int
+main()
+{
+  test_interleaved_nodes_and_expiry();
+  test_eviction_of_the_oldest();
+  test_expire_from_another_thread();
+  return mcan::test::finish();
+}
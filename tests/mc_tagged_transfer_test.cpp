@@ -0,0 +1,192 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Tagged transfers: a corrupted payload or trailer is rejected by the CRC and length
+ * check, a fragment of a new generation restarts reassembly, and with a two byte index
+ * the generation and the trailer land where the receiver expects them, also when the
+ * trailer is split over the last two fragments.
+ */
+
+#include "mc_common.hpp"
+#include "test_util.hpp"
+#include <array>
+#include <memory>
+#include <vector>
+
+using namespace mcan;
+using mcan::test::TestCan;
+
+namespace {
+
+template<size_t Size>
+struct Tagged
+{
+  static constexpr uint32_t k_base_address = 0x400 + Size;
+  static constexpr bool k_tagged_transfer = true;
+  using Type = std::array<uint8_t, Size>;
+  Type value;
+};
+
+using Small = Tagged<40>;
+// 1533 bytes need 2 byte indices, a classic fragment then carries 5 bytes and
+// 1533 % 5 == 3 puts 2 trailer bytes into each of the last two fragments
+using Wide = Tagged<1533>;
+static_assert(!mcan_wide_index_v<Small>);
+static_assert(mcan_wide_index_v<Wide>);
+static_assert(mcan_fragment_header_size<Wide>() == 3);
+
+template<typename T>
+std::vector<CanFrame>
+send(uint8_t fill, bool is_fd = false)
+{
+  TestCan can(is_fd);
+  auto message = std::make_unique<T>();
+  for (size_t i = 0; i < message->value.size(); ++i) {
+    message->value[i] = static_cast<uint8_t>(fill + i);
+  }
+  MCAN_CHECK(mcan_pack_send_msg(can, *message, 3).ok());
+  return can.sent;
+}
+
+/// @brief Feed the frames, return the status of the last one.
+template<typename T>
+Status
+feed(const std::vector<CanFrame>& frames, CanMultiPackageFrame<T>& state)
+{
+  Status status = Status::OK();
+  for (const CanFrame& frame : frames) {
+    status = mcan_unpack_msg(frame, state);
+  }
+  return status;
+}
+
+template<typename T>
+bool
+filled_with(const CanMultiPackageFrame<T>& state, uint8_t fill)
+{
+  for (size_t i = 0; i < state.value.size(); ++i) {
+    if (state.value[i] != static_cast<uint8_t>(fill + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+test_crc_mismatch_is_rejected()
+{
+  CanMultiPackageFrame<Small> state{};
+  std::vector<CanFrame> frames = send<Small>(0x10);
+  frames[1].data[4] ^= 0x01;
+  Status status = feed(frames, state);
+  MCAN_CHECK(status.status_code() == StatusCode::Invalid);
+  MCAN_CHECK(status.to_string().find("CRC") != std::string::npos);
+  // the sender's next attempt is a new generation and goes through
+  MCAN_CHECK(feed(send<Small>(0x10), state).ok() && filled_with(state, 0x10));
+
+  // a corrupted length in the trailer is rejected the same way
+  frames = send<Small>(0x20);
+  CanFrame& last = frames.back();
+  const size_t trailer_end = last.size;
+  last.data[trailer_end - MCAN_TRANSFER_TRAILER_SIZE] ^= 0x01;
+  MCAN_CHECK(feed(frames, state).status_code() == StatusCode::Invalid);
+}
+
+void
+test_generation_change_restarts()
+{
+  CanMultiPackageFrame<Small> state{};
+  std::vector<CanFrame> first = send<Small>(0x30);
+  std::vector<CanFrame> second = send<Small>(0x40);
+  MCAN_CHECK(first[0].data[1] != second[0].data[1]);
+  // half of the first transfer, then all of the second: the stale half is dropped
+  for (size_t i = 0; i < first.size() / 2; ++i) {
+    MCAN_CHECK(mcan_unpack_msg(first[i], state).status_code() == StatusCode::Cancelled);
+  }
+  MCAN_CHECK(feed(second, state).ok() && filled_with(state, 0x40));
+
+  // a fragment of an old generation in the middle restarts with that generation, the
+  // rest of the newer transfer then no longer completes
+  std::vector<CanFrame> third = send<Small>(0x50);
+  std::vector<CanFrame> mixed(third.begin(), third.end() - 1);
+  mixed.push_back(first.back());
+  mixed.push_back(third.back());
+  Status status = Status::OK();
+  size_t completed = 0;
+  for (const CanFrame& frame : mixed) {
+    status = mcan_unpack_msg(frame, state);
+    completed += status.ok() ? 1 : 0;
+  }
+  MCAN_CHECK(completed == 0 && status.status_code() == StatusCode::Cancelled);
+}
+
+void
+test_wide_index_with_trailer()
+{
+  for (bool is_fd : { false, true }) {
+    std::vector<CanFrame> frames = send<Wide>(0x60, is_fd);
+    const size_t count = mcan_transfer_fragment_count<Wide>(is_fd);
+    MCAN_CHECK(frames.size() == count);
+    const CanFrame& last = frames.back();
+    MCAN_CHECK(static_cast<size_t>(last.data[0] | (last.data[1] << 8)) == count - 1);
+    // every fragment of one transfer has the same generation, after the 2 byte index
+    for (const CanFrame& frame : frames) {
+      MCAN_CHECK(frame.data[2] == frames[0].data[2]);
+    }
+    auto state = std::make_unique<CanMultiPackageFrame<Wide>>();
+    if (!is_fd) {
+      MCAN_CHECK(count > 256);
+      // the trailer is split, 2 bytes end the second to last fragment
+      MCAN_CHECK(frames[count - 1].size == 3 + 2);
+      // a corrupted CRC byte in the last fragment, after an index above 255
+      std::vector<CanFrame> corrupted = frames;
+      corrupted.back().data[4] ^= 0xFF;
+      MCAN_CHECK(feed(corrupted, *state).status_code() == StatusCode::Invalid);
+      // a corrupted length byte at the end of the second to last fragment
+      corrupted = frames;
+      CanFrame& split = corrupted[count - 2];
+      split.data[split.size - 2] ^= 0x01;
+      MCAN_CHECK(feed(corrupted, *state).status_code() == StatusCode::Invalid);
+    }
+    // the last fragment first: the trailer is kept until the message is complete
+    std::vector<CanFrame> reordered{ frames.back() };
+    reordered.insert(reordered.end(), frames.begin(), frames.end() - 1);
+    MCAN_CHECK(feed(reordered, *state).ok() && filled_with(*state, 0x60));
+  }
+}
+
+} // namespace
+
+int
+main()
+{
+  test_crc_mismatch_is_rejected();
+  test_generation_change_restarts();
+  test_wide_index_with_trailer();
+  return mcan::test::finish();
+}
@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Round trips of multi frame messages at the sizes where the fragment index gets wider
+ * (more than 256 fragments) and at MAX_STRUCT_SIZE, for classic CAN and CAN FD, with
+ * the fragments in order and shuffled.
+ */
+
+#include "mc_common.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace mcan;
+
+namespace {
+
+template<size_t Size, bool Tagged>
+struct TestMessage
+{
+  static constexpr uint32_t k_base_address = 0x100 + Size;
+  static constexpr bool k_tagged_transfer = Tagged;
+  using Type = std::array<uint8_t, Size>;
+  Type value;
+};
+
+/// @brief Bus that only records the sent frames.
+class RecordingCan : public CanBase
+{
+ public:
+  explicit RecordingCan(bool is_fd)
+    : _is_fd(is_fd)
+  {
+  }
+
+  Status send(const CanFrame& frame) override
+  {
+    sent.push_back(frame);
+    return Status::OK();
+  }
+
+  Result<CanFrame> send_await_response(const CanFrame&, uint32_t, uint32_t) override
+  {
+    return Status::TimeOut("No response received for the CAN frame"_status);
+  }
+
+  Status add_callback(uint32_t, can_callback_type, void*) override
+  {
+    return Status::OK();
+  }
+
+  Status add_callback_masked(uint32_t, uint32_t, can_callback_type, void*) override
+  {
+    return Status::OK();
+  }
+
+  Status remove_callback(uint32_t) override { return Status::OK(); }
+
+  Status remove_callback_masked(uint32_t, uint32_t) override { return Status::OK(); }
+
+  Status open_can() override { return Status::OK(); }
+
+  Status close_can() override { return Status::OK(); }
+
+  bool supports_fd() const override { return _is_fd; }
+
+  std::vector<CanFrame> sent;
+
+ private:
+  bool _is_fd;
+};
+
+int failures = 0;
+
+void
+check(bool condition, const char* what, size_t size, bool is_fd, bool shuffled)
+{
+  if (!condition) {
+    ++failures;
+    std::printf(
+      "FAILED %s: size=%zu fd=%d shuffled=%d\n", what, size, is_fd, shuffled);
+  }
+}
+
+template<size_t Size, bool Tagged>
+void
+round_trip(bool wide_index)
+{
+  using T = TestMessage<Size, Tagged>;
+  check(mcan_wide_index_v<T> == wide_index, "wide index", Size, false, false);
+  for (bool is_fd : { false, true }) {
+    for (bool shuffled : { false, true }) {
+      RecordingCan can(is_fd);
+      auto sent = std::make_unique<T>();
+      for (size_t i = 0; i < Size; ++i) {
+        sent->value[i] = static_cast<uint8_t>(i * 7 + i / 256);
+      }
+      check(mcan_pack_send_msg(can, *sent, 5).ok(), "send", Size, is_fd, shuffled);
+      check(can.sent.size() == mcan_transfer_fragment_count<T>(is_fd),
+            "fragment count",
+            Size,
+            is_fd,
+            shuffled);
+      if (shuffled) {
+        std::mt19937 generator(Size);
+        std::shuffle(can.sent.begin(), can.sent.end(), generator);
+      }
+
+      auto received = std::make_unique<CanMultiPackageFrame<T>>();
+      size_t completed = 0;
+      Status status = Status::OK();
+      for (CanFrame frame : can.sent) {
+        if (frame.is_fd) {
+          // the driver pads CAN FD frames to the next valid length
+          frame.size = can_dlc_to_length(can_length_to_dlc(frame.size, true), true);
+        }
+        status = mcan_unpack_msg(frame, *received);
+        completed += status.ok() ? 1 : 0;
+      }
+      check(status.ok() && completed == 1, "complete once", Size, is_fd, shuffled);
+      check(received->value == sent->value, "payload", Size, is_fd, shuffled);
+    }
+  }
+}
+
+} // namespace
+
+int
+main()
+{
+  // 256 fragments of 7 bytes are the most a one byte index addresses
+  round_trip<1792, false>(false);
+  round_trip<1793, false>(true);
+  // a tagged fragment carries 6 bytes and the transfer a 4 byte trailer
+  round_trip<1532, true>(false);
+  round_trip<1533, true>(true);
+  round_trip<MAX_STRUCT_SIZE, false>(true);
+  round_trip<MAX_STRUCT_SIZE - MCAN_TRANSFER_TRAILER_SIZE, true>(true);
+  round_trip<100, false>(false);
+  round_trip<100, true>(false);
+  std::printf("%d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * PendingRequestTable: FIFO order per response ID with CAN_ANY_FRAME requests competing
+ * by age, cancelling by handle, stale handles, and the timer wheel expiring every
+ * request exactly at its deadline across all levels, against a reference.
+ */
+
+#include "pending_request_table.hpp"
+#include "test_util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace mcan;
+
+namespace {
+
+using Table = PendingRequestTable<int>;
+
+constexpr uint64_t k_far = 1000000;
+
+void
+test_fifo_per_id()
+{
+  Table table;
+  table.insert(0x100, k_far, 0, 1);
+  table.insert(0x200, k_far, 0, 2);
+  table.insert(0x100, k_far, 0, 3);
+  table.insert(CAN_ANY_FRAME, k_far, 0, 4);
+  table.insert(0x100, k_far, 0, 5);
+  int handler = 0;
+  MCAN_CHECK(table.take_match(0x100, handler) && handler == 1);
+  MCAN_CHECK(table.take_match(0x100, handler) && handler == 3);
+  // the request for any frame is older than the last one for 0x100
+  MCAN_CHECK(table.take_match(0x100, handler) && handler == 4);
+  MCAN_CHECK(table.take_match(0x100, handler) && handler == 5);
+  MCAN_CHECK(!table.take_match(0x100, handler));
+  MCAN_CHECK(table.find_match(0x300) == Table::k_invalid_handle);
+  MCAN_CHECK(table.take_match(0x200, handler) && handler == 2);
+  MCAN_CHECK(table.empty());
+  size_t ids = 0;
+  table.for_each_response_id([&](uint32_t) { ++ids; });
+  MCAN_CHECK(ids == 0);
+}
+
+void
+test_cancel()
+{
+  Table table;
+  uint64_t first = table.insert(0x100, 10, 0, 1);
+  uint64_t second = table.insert(0x100, 10, 0, 2);
+  uint64_t third = table.insert(0x100, 20, 0, 3);
+  MCAN_CHECK(table.erase(second));
+  MCAN_CHECK(!table.erase(second));
+  MCAN_CHECK(table.size() == 2);
+  int handler = 0;
+  MCAN_CHECK(table.take_match(0x100, handler) && handler == 1);
+  MCAN_CHECK(!table.erase(first));
+  // the slot of a removed request is reused, its old handle stays invalid
+  uint64_t reused = table.insert(0x100, 10, 0, 4);
+  MCAN_CHECK(static_cast<uint32_t>(reused) == static_cast<uint32_t>(first) ||
+             static_cast<uint32_t>(reused) == static_cast<uint32_t>(second));
+  MCAN_CHECK(!table.erase(first) && !table.erase(second));
+  std::vector<int> expired;
+  table.expire(10, [&](int&& h) { expired.push_back(h); });
+  MCAN_CHECK(expired == std::vector<int>{ 4 });
+  MCAN_CHECK(table.erase(third));
+  table.expire(30, [&](int&& h) { expired.push_back(h); });
+  MCAN_CHECK(expired.size() == 1 && table.empty());
+}
+
+void
+test_wheel_levels_expire_on_time()
+{
+  Table table;
+  // one deadline per wheel level, on both sides of the level boundaries
+  const std::vector<uint64_t> deadlines{ 1,      63,     64,     65,      4095,
+                                         4096,   4097,   262143, 262144,  262145,
+                                         300000, 16777217 };
+  for (size_t i = 0; i < deadlines.size(); ++i) {
+    table.insert(0x100 + static_cast<uint32_t>(i), deadlines[i], 0, static_cast<int>(i));
+  }
+  uint64_t now = 0;
+  size_t next = 0;
+  while (!table.empty()) {
+    uint64_t due = table.next_expiry_tick();
+    MCAN_CHECK(due > now && due <= deadlines[next]);
+    table.expire(due, [&](int&& h) {
+      MCAN_CHECK(static_cast<size_t>(h) == next);
+      MCAN_CHECK(deadlines[next] == due);
+      ++next;
+    });
+    now = due;
+  }
+  MCAN_CHECK(next == deadlines.size());
+  MCAN_CHECK(table.next_expiry_tick() == Table::k_no_expiry);
+}
+
+void
+test_random_expiry_matches_reference()
+{
+  std::mt19937 generator(11);
+  Table table;
+  // handler -> deadline and handle of the requests still pending
+  std::map<int, std::pair<uint64_t, uint64_t>> pending;
+  uint64_t now = 0;
+  int next_handler = 0;
+  for (int step = 0; step < 20000; ++step) {
+    switch (generator() % 4) {
+      case 0:
+      case 1: {
+        // mostly short timeouts, some far enough to cascade through several levels
+        uint64_t timeout =
+          generator() % 8 == 0 ? generator() % 300000 : generator() % 200;
+        uint64_t deadline = now + timeout;
+        uint64_t handle = table.insert(
+          0x100 + generator() % 16, deadline, now, next_handler);
+        pending[next_handler++] = { deadline, handle };
+        break;
+      }
+      case 2:
+        if (!pending.empty()) {
+          auto it = std::next(pending.begin(),
+                              static_cast<long>(generator() % pending.size()));
+          MCAN_CHECK(table.erase(it->second.second));
+          pending.erase(it);
+        }
+        break;
+      default: {
+        uint64_t previous = now;
+        now += generator() % 100;
+        uint64_t last_deadline = 0;
+        table.expire(now, [&](int&& h) {
+          auto it = pending.find(h);
+          MCAN_CHECK(it != pending.end());
+          if (it == pending.end()) {
+            return;
+          }
+          uint64_t deadline = std::max(it->second.first, previous + 1);
+          MCAN_CHECK(deadline <= now && deadline >= last_deadline);
+          last_deadline = deadline;
+          pending.erase(it);
+        });
+        // a deadline at the current tick waits for the next call that advances
+        for (const auto& [h, request] : pending) {
+          MCAN_CHECK(request.first > now || (now == previous && request.first == now));
+        }
+        break;
+      }
+    }
+    MCAN_CHECK(table.size() == pending.size());
+  }
+}
+
+void
+test_take_all()
+{
+  Table table;
+  for (int i = 0; i < 5; ++i) {
+    table.insert(i % 2 ? CAN_ANY_FRAME : 0x100, 50, 0, i);
+  }
+  int sum = 0;
+  table.take_all([&](int&& h) { sum += h; });
+  MCAN_CHECK(sum == 10 && table.empty());
+  MCAN_CHECK(table.find_match(0x100) == Table::k_invalid_handle);
+}
+
+} // namespace
+
+int
+main()
+{
+  test_fifo_per_id();
+  test_cancel();
+  test_wheel_levels_expire_on_time();
+  test_random_expiry_matches_reference();
+  test_take_all();
+  return mcan::test::finish();
+}
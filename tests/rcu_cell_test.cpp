@@ -0,0 +1,178 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * RcuCell: a snapshot stays valid while writers publish new versions, a writer waits
+ * for the readers of its own cell only, updates from inside a read section of the same
+ * cell are deferred, and readers never see a torn version under concurrent updates.
+ */
+
+#include "rcu_cell.hpp"
+#include "test_util.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace mcan;
+
+namespace {
+
+/// @brief Version whose elements are all equal, a torn or freed copy breaks that.
+struct Version
+{
+  static inline std::atomic<int> alive{ 0 };
+
+  std::array<uint64_t, 16> values{};
+
+  Version() { ++alive; }
+  Version(const Version& other)
+    : values(other.values)
+  {
+    ++alive;
+  }
+  ~Version()
+  {
+    values.fill(0xDEAD);
+    --alive;
+  }
+
+  bool consistent() const
+  {
+    for (uint64_t value : values) {
+      if (value != values[0]) {
+        return false;
+      }
+    }
+    return values[0] != 0xDEAD;
+  }
+};
+
+bool
+set_all(Version& version, uint64_t value)
+{
+  version.values.fill(value);
+  return true;
+}
+
+void
+test_snapshot_outlives_update()
+{
+  RcuCell<Version> cell;
+  std::atomic<bool> updated{ false };
+  std::thread writer;
+  {
+    auto guard = cell.read();
+    writer = std::thread([&] {
+      cell.update([](Version& v) { return set_all(v, 1); });
+      updated = true;
+    });
+    // the new version is published at once, the writer then waits for this reader
+    while (cell.read()->values[0] != 1) {
+      std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    MCAN_CHECK(!updated);
+    MCAN_CHECK(guard->values[0] == 0 && guard->consistent());
+  }
+  writer.join();
+  MCAN_CHECK(updated);
+  MCAN_CHECK(Version::alive == 1);
+}
+
+void
+test_update_inside_read_section()
+{
+  RcuCell<Version> cell;
+  RcuCell<Version> other;
+  {
+    auto guard = cell.read();
+    // a writer in a read section of the same cell can not wait for it, the old version
+    // is kept until a later update
+    MCAN_CHECK(cell.update([](Version& v) { return set_all(v, 1); }));
+    MCAN_CHECK(Version::alive == 3);
+    MCAN_CHECK(guard->values[0] == 0 && cell.read()->values[0] == 1);
+    // sections of another cell do not hold back its writers
+    MCAN_CHECK(other.update([](Version& v) { return set_all(v, 2); }));
+    MCAN_CHECK(Version::alive == 3);
+    MCAN_CHECK(!cell.update([](Version&) { return false; }));
+  }
+  MCAN_CHECK(cell.update([](Version& v) { return set_all(v, 3); }));
+  MCAN_CHECK(Version::alive == 2);
+}
+
+void
+test_readers_see_whole_versions()
+{
+  RcuCell<Version> cell;
+  std::atomic<bool> stop{ false };
+  std::atomic<int> torn{ 0 };
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 3; ++r) {
+    readers.emplace_back([&] {
+      uint64_t last = 0;
+      while (!stop) {
+        auto guard = cell.read();
+        if (!guard->consistent() || guard->values[0] < last) {
+          ++torn;
+        }
+        last = guard->values[0];
+      }
+    });
+  }
+  std::vector<std::thread> writers;
+  std::atomic<uint64_t> next{ 1 };
+  for (int w = 0; w < 2; ++w) {
+    writers.emplace_back([&] {
+      for (int i = 0; i < 500; ++i) {
+        cell.update([&](Version& v) { return set_all(v, next++); });
+      }
+    });
+  }
+  for (std::thread& writer : writers) {
+    writer.join();
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  MCAN_CHECK(torn == 0);
+  MCAN_CHECK(cell.read()->values[0] == 1000);
+}
+
+} // namespace
+
+int
+main()
+{
+  test_snapshot_outlives_update();
+  test_update_inside_read_section();
+  test_readers_see_whole_versions();
+  MCAN_CHECK(Version::alive == 0);
+  return mcan::test::finish();
+}
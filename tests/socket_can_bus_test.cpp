@@ -0,0 +1,548 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * SocketCanBus against a peer on the other end of a socket pair, which carries one
+ * struct can_frame per datagram like a CAN_RAW socket, so the driver threads and the
+ * io_uring loop run for real without a CAN interface: plain RX/TX, responses to
+ * send_await_response() and its async and stream variants with their timeouts, frames
+ * too long for their format, and closing the bus. The io_uring cases are skipped if the
+ * kernel does not support the loop. Also built with ThreadSanitizer, see CMakeLists.txt.
+ */
+
+#include "io_uring_loop.hpp"
+#include "socket_can_bus.hpp"
+#include "test_util.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <linux/can.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace mcan;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief Wait until the predicate holds, at most timeout.
+template<typename Predicate>
+bool
+wait_until(Predicate&& predicate,
+           std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+{
+  auto deadline = Clock::now() + timeout;
+  while (!predicate()) {
+    if (Clock::now() >= deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  return true;
+}
+
+/// @brief Bus running on one end of a socket pair, the test plays the peer on the
+/// other end.
+struct Loopback
+{
+  explicit Loopback(std::shared_ptr<IoUringLoop> loop, SocketCanConfig config = {})
+  {
+    int fds[2];
+    MCAN_CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == 0);
+    peer_fd = fds[1];
+    config.io_uring_loop = std::move(loop);
+    bus = std::make_unique<SocketCanBus>(std::move(config));
+    socket_fd = fds[0];
+  }
+
+  ~Loopback()
+  {
+    bus.reset();
+    close(peer_fd);
+  }
+
+  Status open() { return bus->open_can(socket_fd); }
+
+  void peer_send(uint32_t id, uint32_t value, uint8_t size = 4)
+  {
+    can_frame frame{};
+    frame.can_id = id | CAN_EFF_FLAG;
+    frame.len = size;
+    std::memcpy(frame.data, &value, sizeof(value));
+    MCAN_CHECK(write(peer_fd, &frame, sizeof(frame)) == sizeof(frame));
+  }
+
+  /// @return false if the bus sent nothing within the timeout.
+  bool peer_receive(can_frame& frame, int timeout_ms = 5000)
+  {
+    pollfd fd{ peer_fd, POLLIN, 0 };
+    return poll(&fd, 1, timeout_ms) == 1 &&
+           read(peer_fd, &frame, sizeof(frame)) == sizeof(frame);
+  }
+
+  std::unique_ptr<SocketCanBus> bus;
+  int socket_fd = -1;
+  int peer_fd = -1;
+};
+
+CanFrame
+make_frame(uint32_t id, uint32_t value)
+{
+  CanFrame frame{};
+  frame.id = id;
+  frame.is_extended = true;
+  frame.size = 4;
+  std::memcpy(frame.data, &value, sizeof(value));
+  return frame;
+}
+
+uint32_t
+frame_value(const uint8_t* data)
+{
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+void
+test_frames_pass_in_order(std::shared_ptr<IoUringLoop> loop)
+{
+  SocketCanConfig config;
+  config.io_batch_size = 16;
+  Loopback loopback(std::move(loop), config);
+  constexpr uint32_t k_count = 2000;
+  std::atomic<uint32_t> received{ 0 };
+  std::atomic<bool> in_order{ true };
+  MCAN_CHECK(loopback.bus
+               ->add_callback(0x123,
+                              [&](CanBase&, const CanFrame& frame, void*) {
+                                in_order = in_order && frame_value(frame.data) ==
+                                                         received.load();
+                                ++received;
+                              })
+               .ok());
+  MCAN_CHECK(loopback.open().ok());
+
+  std::thread peer([&] {
+    for (uint32_t i = 0; i < k_count; ++i) {
+      loopback.peer_send(0x123, i);
+    }
+  });
+  uint32_t sent_in_order = 0;
+  std::thread reader([&] {
+    can_frame frame;
+    while (sent_in_order < k_count && loopback.peer_receive(frame) &&
+           frame.can_id == (0x55 | CAN_EFF_FLAG) &&
+           frame_value(frame.data) == sent_in_order) {
+      ++sent_in_order;
+    }
+  });
+  for (uint32_t i = 0; i < k_count; ++i) {
+    while (loopback.bus->send(make_frame(0x55, i)).status_code() ==
+           StatusCode::CapacityError) {
+      std::this_thread::yield();
+    }
+  }
+  peer.join();
+  reader.join();
+  MCAN_CHECK(sent_in_order == k_count);
+  MCAN_CHECK(wait_until([&] { return received == k_count; }));
+  MCAN_CHECK(in_order);
+  MCAN_CHECK(loopback.bus->close_can().ok());
+}
+
+void
+test_oversized_frames_are_rejected(std::shared_ptr<IoUringLoop> loop)
+{
+  Loopback loopback(std::move(loop));
+  MCAN_CHECK(loopback.open().ok());
+  CanFrame frame = make_frame(0x55, 1);
+  frame.size = CAN_MAX_DATA_LENGTH + 1;
+  MCAN_CHECK(loopback.bus->send(frame).status_code() == StatusCode::Invalid);
+  Result<CanFrame> response = loopback.bus->send_await_response(frame, 0x56, 100);
+  MCAN_CHECK(response.status().status_code() == StatusCode::Invalid);
+  // the socket pair carries classic frames only
+  frame.is_fd = true;
+  frame.size = CAN_FD_MAX_DATA_LENGTH;
+  MCAN_CHECK(loopback.bus->send(frame).status_code() == StatusCode::NotImplemented);
+  // only the frame that fits reaches the peer
+  frame = make_frame(0x55, 2);
+  frame.size = CAN_MAX_DATA_LENGTH;
+  MCAN_CHECK(loopback.bus->send(frame).ok());
+  can_frame received{};
+  MCAN_CHECK(loopback.peer_receive(received));
+  MCAN_CHECK(frame_value(received.data) == 2 && received.len == CAN_MAX_DATA_LENGTH);
+  MCAN_CHECK(!loopback.peer_receive(received, 50));
+  MCAN_CHECK(loopback.bus->close_can().ok());
+}
+
+void
+test_close_from_callback_is_refused(std::shared_ptr<IoUringLoop> loop)
+{
+  Loopback loopback(std::move(loop));
+  std::atomic<bool> called{ false };
+  Status status = Status::OK();
+  MCAN_CHECK(loopback.bus
+               ->add_callback(0x123,
+                              [&](CanBase& bus, const CanFrame&, void*) {
+                                status = bus.close_can();
+                                called = true;
+                              })
+               .ok());
+  MCAN_CHECK(loopback.open().ok());
+  loopback.peer_send(0x123, 0);
+  MCAN_CHECK(wait_until([&] { return called.load(); }));
+  MCAN_CHECK(status.status_code() == StatusCode::Invalid);
+  // still running
+  MCAN_CHECK(loopback.bus->send(make_frame(0x55, 1)).ok());
+  can_frame frame;
+  MCAN_CHECK(loopback.peer_receive(frame));
+  MCAN_CHECK(loopback.bus->close_can().ok());
+}
+
+/// @brief send() from several threads while close_can() runs, the TSan build checks
+/// that they never touch the TX notification or the loop being torn down.
+void
+test_send_races_close(std::shared_ptr<IoUringLoop> loop)
+{
+  for (int round = 0; round < 50; ++round) {
+    Loopback loopback(loop);
+    MCAN_CHECK(loopback.open().ok());
+    std::atomic<bool> stop{ false };
+    std::vector<std::thread> senders;
+    for (int i = 0; i < 3; ++i) {
+      senders.emplace_back([&] {
+        while (!stop) {
+          (void)loopback.bus->send(make_frame(0x55, 0));
+        }
+      });
+    }
+    // drained as fast as possible, so the queue keeps running empty and every send()
+    // after that notifies the TX side
+    std::thread drain([&] {
+      can_frame frame;
+      while (!stop) {
+        (void)recv(loopback.peer_fd, &frame, sizeof(frame), MSG_DONTWAIT);
+      }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    MCAN_CHECK(loopback.bus->close_can().ok());
+    MCAN_CHECK(loopback.bus->send(make_frame(0x55, 0)).status_code() ==
+               StatusCode::IOError);
+    stop = true;
+    for (auto& sender : senders) {
+      sender.join();
+    }
+    drain.join();
+  }
+}
+
+/// @brief A receive error does not stop the RX side. The bus runs on a connected UDP
+/// socket, sending to the closed peer port leaves ECONNREFUSED for the next receive,
+/// the way a bounced interface leaves ENETDOWN on a CAN socket.
+void
+test_receive_error_is_reported_and_survived(std::shared_ptr<IoUringLoop> loop)
+{
+  auto udp_socket = [](sockaddr_in& address) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    socklen_t size = sizeof(address);
+    MCAN_CHECK(bind(fd, reinterpret_cast<sockaddr*>(&address), size) == 0);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size);
+    return fd;
+  };
+  sockaddr_in bus_address{};
+  bus_address.sin_family = AF_INET;
+  bus_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sockaddr_in peer_address = bus_address;
+  int bus_fd = udp_socket(bus_address);
+  int peer_fd = udp_socket(peer_address);
+  MCAN_CHECK(connect(bus_fd, reinterpret_cast<sockaddr*>(&peer_address),
+                     sizeof(peer_address)) == 0);
+
+  SocketCanConfig config;
+  config.io_uring_loop = std::move(loop);
+  std::atomic<int> errors{ 0 };
+  config.rx_error_handler = [&](const Status& status) {
+    MCAN_CHECK(status.status_code() == StatusCode::IOError);
+    ++errors;
+  };
+  SocketCanBus bus(config);
+  std::atomic<int> received{ 0 };
+  MCAN_CHECK(bus.add_callback(0x123,
+                              [&](CanBase&, const CanFrame&, void*) { ++received; })
+               .ok());
+  MCAN_CHECK(bus.open_can(bus_fd).ok());
+
+  close(peer_fd);
+  MCAN_CHECK(bus.send(make_frame(0x55, 0)).ok());
+  MCAN_CHECK(wait_until([&] { return errors > 0; }));
+
+  // the peer comes back on the same port, its frames still get through
+  peer_fd = udp_socket(peer_address);
+  MCAN_CHECK(wait_until([&] {
+    can_frame frame{};
+    frame.can_id = 0x123 | CAN_EFF_FLAG;
+    (void)sendto(peer_fd, &frame, sizeof(frame), 0,
+                 reinterpret_cast<sockaddr*>(&bus_address), sizeof(bus_address));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    return received > 0;
+  }));
+  MCAN_CHECK(errors == 1);
+  MCAN_CHECK(bus.close_can().ok());
+  close(peer_fd);
+}
+
+/// @brief Answer count requests on the peer side, respond(request, response) fills in
+/// the response and returns false to leave the request unanswered.
+template<typename Respond>
+std::thread
+start_responder(Loopback& loopback, size_t count, Respond respond)
+{
+  return std::thread([&loopback, count, respond] {
+    for (size_t i = 0; i < count; ++i) {
+      can_frame request;
+      if (!loopback.peer_receive(request)) {
+        return;
+      }
+      can_frame response{};
+      if (respond(request, response)) {
+        MCAN_CHECK(write(loopback.peer_fd, &response, sizeof(response)) ==
+                   sizeof(response));
+      }
+    }
+  });
+}
+
+void
+test_send_await_response(std::shared_ptr<IoUringLoop> loop)
+{
+  Loopback loopback(std::move(loop));
+  MCAN_CHECK(loopback.open().ok());
+  std::thread responder =
+    start_responder(loopback, 2, [](const can_frame& request, can_frame& response) {
+      if ((request.can_id & CAN_EFF_MASK) != 0x776) {
+        return false;
+      }
+      response.can_id = 0x777 | CAN_EFF_FLAG;
+      response.len = 4;
+      std::memcpy(response.data, request.data, 4);
+      return true;
+    });
+  auto result = loopback.bus->send_await_response(make_frame(0x776, 42), 0x777, 1000);
+  MCAN_CHECK(result.ok() && frame_value(result.valueOrDie().data) == 42);
+
+  // nobody answers this one
+  auto start = Clock::now();
+  result = loopback.bus->send_await_response(make_frame(0x778, 0), 0x779, 50);
+  MCAN_CHECK(result.status().status_code() == StatusCode::TimeOut);
+  MCAN_CHECK(Clock::now() - start >= std::chrono::milliseconds(50));
+  responder.join();
+  MCAN_CHECK(loopback.bus->close_can().ok());
+}
+
+void
+test_async_requests_and_timeouts(std::shared_ptr<IoUringLoop> loop)
+{
+  Loopback loopback(std::move(loop));
+  MCAN_CHECK(loopback.open().ok());
+  // the peer answers the even nodes, the requests to the odd ones time out
+  constexpr uint32_t k_requests = 200;
+  std::thread responder = start_responder(
+    loopback, k_requests, [](const can_frame& request, can_frame& response) {
+      uint32_t node = request.can_id & 0xFF;
+      response.can_id = ((0x900u << 8) | node) | CAN_EFF_FLAG;
+      response.len = 4;
+      std::memcpy(response.data, &node, 4);
+      return node % 2 == 0;
+    });
+  std::atomic<uint32_t> answered{ 0 };
+  std::atomic<uint32_t> timed_out{ 0 };
+  std::atomic<uint32_t> wrong{ 0 };
+  for (uint32_t node = 0; node < k_requests; ++node) {
+    MCAN_CHECK(loopback.bus
+                 ->send_await_response_async(
+                   make_frame((0x800u << 8) | node, 0),
+                   (0x900u << 8) | node,
+                   100,
+                   CanBase::response_handler_type([&, node](Result<CanFrame> result) {
+                     if (result.ok()) {
+                       wrong += frame_value(result.valueOrDie().data) != node;
+                       ++answered;
+                     } else if (result.status().status_code() == StatusCode::TimeOut) {
+                       wrong += node % 2 == 0;
+                       ++timed_out;
+                     } else {
+                       ++wrong;
+                     }
+                   }))
+                 .ok());
+  }
+  responder.join();
+  MCAN_CHECK(
+    wait_until([&] { return answered + timed_out == k_requests; }));
+  MCAN_CHECK(answered == k_requests / 2 && timed_out == k_requests / 2);
+  MCAN_CHECK(wrong == 0);
+
+  // requests for the same ID are completed in the order they were made
+  std::vector<uint32_t> order;
+  std::mutex order_mutex;
+  for (uint32_t i = 0; i < 3; ++i) {
+    MCAN_CHECK(loopback.bus
+                 ->send_await_response_async(
+                   make_frame(0x500, i),
+                   0x501,
+                   1000,
+                   CanBase::response_handler_type([&](Result<CanFrame> result) {
+                     std::lock_guard<std::mutex> lock(order_mutex);
+                     order.push_back(result.ok() ? frame_value(result.valueOrDie().data)
+                                                 : 99);
+                   }))
+                 .ok());
+  }
+  for (uint32_t i = 0; i < 3; ++i) {
+    can_frame request;
+    MCAN_CHECK(loopback.peer_receive(request));
+    loopback.peer_send(0x501, 10 + i);
+  }
+  MCAN_CHECK(wait_until([&] {
+    std::lock_guard<std::mutex> lock(order_mutex);
+    return order.size() == 3;
+  }));
+  MCAN_CHECK((order == std::vector<uint32_t>{ 10, 11, 12 }));
+
+  // the future variant
+  std::thread late_responder =
+    start_responder(loopback, 1, [](const can_frame&, can_frame& response) {
+      response.can_id = 0x601 | CAN_EFF_FLAG;
+      response.len = 4;
+      return true;
+    });
+  auto future = loopback.bus->send_await_response_future(make_frame(0x600, 0), 0x601);
+  MCAN_CHECK(future.get().ok());
+  late_responder.join();
+  MCAN_CHECK(loopback.bus->close_can().ok());
+}
+
+void
+test_response_streams(std::shared_ptr<IoUringLoop> loop)
+{
+  Loopback loopback(std::move(loop));
+  MCAN_CHECK(loopback.open().ok());
+  // the stream takes frames until its handler returns false, the rest goes to the next
+  // request for the ID
+  std::atomic<uint32_t> streamed{ 0 };
+  std::atomic<bool> stream_ok{ true };
+  MCAN_CHECK(loopback.bus
+               ->send_await_response_stream_async(
+                 make_frame(0x700, 0),
+                 0x701,
+                 1000,
+                 CanBase::response_stream_handler_type([&](Result<CanFrame> result) {
+                   stream_ok = stream_ok && result.ok() &&
+                               frame_value(result.valueOrDie().data) == streamed;
+                   return ++streamed < 3;
+                 }))
+               .ok());
+  auto next = loopback.bus->send_await_response_future(make_frame(0x700, 1), 0x701);
+  for (uint32_t i = 0; i < 4; ++i) {
+    loopback.peer_send(0x701, i);
+  }
+  auto result = next.get();
+  MCAN_CHECK(result.ok() && frame_value(result.valueOrDie().data) == 3);
+  MCAN_CHECK(streamed == 3 && stream_ok);
+
+  // a stream nobody answers ends with one TimeOut
+  std::atomic<uint32_t> calls{ 0 };
+  std::atomic<bool> timed_out{ false };
+  MCAN_CHECK(loopback.bus
+               ->send_await_response_stream_async(
+                 make_frame(0x700, 2),
+                 0x702,
+                 50,
+                 CanBase::response_stream_handler_type([&](Result<CanFrame> result) {
+                   ++calls;
+                   timed_out = result.status().status_code() == StatusCode::TimeOut;
+                   return true;
+                 }))
+               .ok());
+  MCAN_CHECK(wait_until([&] { return calls > 0; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  MCAN_CHECK(calls == 1 && timed_out);
+  MCAN_CHECK(loopback.bus->close_can().ok());
+}
+
+void
+test_close_cancels_pending_requests(std::shared_ptr<IoUringLoop> loop)
+{
+  Loopback loopback(std::move(loop));
+  MCAN_CHECK(loopback.open().ok());
+  auto future = loopback.bus->send_await_response_future(make_frame(0x600, 0), 0x601);
+  MCAN_CHECK(loopback.bus->close_can().ok());
+  MCAN_CHECK(future.get().status().status_code() == StatusCode::Cancelled);
+}
+
+} // namespace
+
+int
+main()
+{
+  std::vector<std::shared_ptr<IoUringLoop>> loops{ nullptr };
+  // the second loop has a tiny queue, so the SQ runs full and the loop has to arm its
+  // operations later, see IoUringLoop::arm_pending()
+  IoUringLoopConfig small_queue;
+  small_queue.queue_depth = 4;
+  small_queue.tx_chain_length = 3;
+  for (const IoUringLoopConfig& config : { IoUringLoopConfig{}, small_queue }) {
+    auto loop = IoUringLoop::create(config);
+    if (!loop.ok()) {
+      std::printf("io_uring cases skipped: %s\n", loop.status().to_string().c_str());
+      break;
+    }
+    loops.push_back(loop.valueOrDie());
+  }
+  for (const auto& io_uring_loop : loops) {
+    test_frames_pass_in_order(io_uring_loop);
+    test_oversized_frames_are_rejected(io_uring_loop);
+    test_close_from_callback_is_refused(io_uring_loop);
+    test_send_races_close(io_uring_loop);
+    test_receive_error_is_reported_and_survived(io_uring_loop);
+    test_send_await_response(io_uring_loop);
+    test_async_requests_and_timeouts(io_uring_loop);
+    test_response_streams(io_uring_loop);
+    test_close_cancels_pending_requests(io_uring_loop);
+  }
+  return mcan::test::finish();
+}
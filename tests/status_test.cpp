@@ -0,0 +1,224 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+/*
+ * Status messages: literals and dynamic texts are interned, equal messages share one
+ * state whichever thread creates them, and the text survives the source string.
+ * Result<T> is trivially copyable for a trivially copyable T and still copies a value or
+ * an error of any other T, an assignment whose copy throws leaves the target unchanged.
+ */
+
+#include "can_base.hpp"
+#include "status.hpp"
+#include "test_util.hpp"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <thread>
+#include <vector>
+
+using namespace mcan;
+
+namespace {
+
+/// @brief Address of the shared state of a Status, equal for interned messages.
+uintptr_t
+state_of(const Status& status)
+{
+  return std::bit_cast<uintptr_t>(status);
+}
+
+void
+test_literal_messages_are_shared()
+{
+  Status a = Status::Invalid("Bad frame"_status);
+  Status b = Status::Invalid("Bad frame"_status);
+  MCAN_CHECK(state_of(a) == state_of(b));
+  MCAN_CHECK(a.to_string() == "Invalid|Bad frame");
+  MCAN_CHECK(state_of(Status::TimeOut("Bad frame"_status)) != state_of(a));
+  MCAN_CHECK(state_of(Status::OK()) == 0);
+}
+
+void
+test_dynamic_messages_are_interned()
+{
+  std::string text = "Node " + std::to_string(7) + " did not answer";
+  Status formatted = Status::TimeOut(std::string(text));
+  Status view = Status::TimeOut(std::string_view(text));
+  Status pointer = Status::TimeOut(text.c_str());
+  MCAN_CHECK(state_of(formatted) == state_of(view));
+  MCAN_CHECK(state_of(formatted) == state_of(pointer));
+  MCAN_CHECK(state_of(Status::IOError(text.c_str())) != state_of(formatted));
+  MCAN_CHECK(state_of(Status::TimeOut("Node 8 did not answer")) != state_of(formatted));
+  // the state holds its own copy of the text
+  text.assign(text.size(), 'x');
+  MCAN_CHECK(formatted.to_string() == "TimeOut|Node 7 did not answer");
+  MCAN_CHECK(Status::Invalid(static_cast<const char*>(nullptr)).to_string() ==
+             "Invalid|");
+}
+
+void
+test_concurrent_interning_agrees()
+{
+  constexpr size_t k_threads = 4;
+  constexpr size_t k_messages = 64;
+  std::vector<std::vector<uintptr_t>> states(k_threads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < k_threads; ++t) {
+    threads.emplace_back([&states, t] {
+      for (size_t i = 0; i < k_messages; ++i) {
+        states[t].push_back(
+          state_of(Status::Invalid("Concurrent message " + std::to_string(i))));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (size_t t = 1; t < k_threads; ++t) {
+    MCAN_CHECK(states[t] == states[0]);
+  }
+}
+
+static_assert(std::is_trivially_copyable_v<Result<int>>);
+static_assert(std::is_trivially_copyable_v<Result<CanFrame>>);
+static_assert(std::is_trivially_destructible_v<Result<CanFrame>>);
+static_assert(!std::is_trivially_copyable_v<Result<std::string>>);
+
+void
+test_trivial_result_copies()
+{
+  Result<int> value = Result<int>::OK(42);
+  Result<int> copy(Status::Invalid("Not set"_status));
+  std::memcpy(&copy, &value, sizeof(copy));
+  MCAN_CHECK(copy.ok() && copy.valueOrDie() == 42);
+  copy = Result<int>(Status::TimeOut("No response"_status));
+  MCAN_CHECK(copy.status().status_code() == StatusCode::TimeOut);
+}
+
+void
+test_result_copies_any_value()
+{
+  Result<std::string> value = Result<std::string>::OK("a value long enough to allocate");
+  Result<std::string> copy(value);
+  MCAN_CHECK(copy.ok() && copy.valueOrDie() == value.valueOrDie());
+  Result<std::string> error(Status::IOError("Bus down"_status));
+  copy = error;
+  MCAN_CHECK(copy.status().to_string() == "IOError|Bus down");
+  copy = std::move(value);
+  MCAN_CHECK(copy.ok() && copy.valueOrDie() == "a value long enough to allocate");
+}
+
+/// @brief Value whose copies throw while armed, a noexcept move if NothrowMove.
+template<bool NothrowMove>
+struct Fragile
+{
+  static inline bool armed = false;
+
+  int value = 0;
+
+  explicit Fragile(int value)
+    : value(value)
+  {
+  }
+
+  Fragile(const Fragile& other)
+    : value(other.value)
+  {
+    if (armed) {
+      throw std::runtime_error("copy failed");
+    }
+  }
+
+  Fragile(Fragile&& other) noexcept(NothrowMove)
+    : value(other.value)
+  {
+  }
+
+  Fragile& operator=(const Fragile&) = default;
+  Fragile& operator=(Fragile&&) = default;
+};
+
+template<bool NothrowMove>
+void
+test_throwing_copy_keeps_status()
+{
+  using Value = Fragile<NothrowMove>;
+  const Result<Value> value = Result<Value>::OK(Value(7));
+  Result<Value> target(Status::Cancelled("Stopped"_status));
+  Value::armed = true;
+  bool thrown = false;
+  try {
+    target = value;
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  Value::armed = false;
+  MCAN_CHECK(thrown);
+  MCAN_CHECK(target.status().to_string() == "Cancelled|Stopped");
+  target = value;
+  MCAN_CHECK(target.ok() && target.valueOrDie().value == 7);
+  target = Status::Invalid("Cleared"_status);
+  MCAN_CHECK(!target.ok());
+}
+
+void
+test_status_accessor_and_propagate()
+{
+  Result<int> error(Status::TimeOut("No response"_status));
+  const Status& status = error.status();
+  MCAN_CHECK(&status == &error.status());
+  MCAN_CHECK(status.status_code() == StatusCode::TimeOut);
+  MCAN_CHECK(Result<int>::OK(1).status().ok());
+  MCAN_CHECK(Result<void>::OK().status().ok());
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  Result<int> kept = Result<int>::Propagate(5, Status::OK());
+  Result<int> failed = Result<int>::Propagate(5, Status::IOError("Bus down"_status));
+#pragma GCC diagnostic pop
+  MCAN_CHECK(kept.ok() && kept.valueOrDie() == 5);
+  MCAN_CHECK(failed.status().to_string() == "IOError|Bus down");
+}
+
+} // namespace
+
+int
+main()
+{
+  test_literal_messages_are_shared();
+  test_dynamic_messages_are_interned();
+  test_concurrent_interning_agrees();
+  test_trivial_result_copies();
+  test_result_copies_any_value();
+  test_throwing_copy_keeps_status<true>();
+  test_throwing_copy_keeps_status<false>();
+  test_status_accessor_and_propagate();
+  return mcan::test::finish();
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2025 Patryk Dudziński
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Authors: Patryk Dudziński
+ */
+
+
+#pragma once
+
+#include "can_base.hpp"
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+/**
+ * @file test_util.hpp
+ * @brief Checks and a scripted bus shared by the tests, not part of the library.
+ */
+
+namespace mcan::test {
+
+inline int failures = 0;
+
+inline void
+check(bool condition, const char* what, const char* file, int line)
+{
+  if (!condition) {
+    ++failures;
+    std::printf("FAILED %s:%d: %s\n", file, line, what);
+  }
+}
+
+/// @brief Print the number of failed checks.
+/// @return exit code of the test.
+inline int
+finish()
+{
+  std::printf("%d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+/// @brief Bus that records the sent frames, the test scripts the other nodes through
+/// on_send and on_request.
+class TestCan : public CanBase
+{
+ public:
+  explicit TestCan(bool is_fd = false)
+    : _is_fd(is_fd)
+  {
+  }
+
+  Status send(const CanFrame& frame) override
+  {
+    sent.push_back(frame);
+    return on_send ? on_send(frame) : Status::OK();
+  }
+
+  Result<CanFrame> send_await_response(const CanFrame& frame,
+                                       uint32_t response_id,
+                                       uint32_t timeout_ms) override
+  {
+    sent.push_back(frame);
+    if (on_request) {
+      return on_request(frame, response_id, timeout_ms);
+    }
+    return Status::TimeOut("No response received for the CAN frame"_status);
+  }
+
+  using CanBase::add_callback;
+  using CanBase::add_callback_masked;
+
+  Status add_callback(uint32_t, can_callback_type, void*) override
+  {
+    return Status::OK();
+  }
+
+  Status add_callback_masked(uint32_t, uint32_t, can_callback_type, void*) override
+  {
+    return Status::OK();
+  }
+
+  Status remove_callback(uint32_t) override { return Status::OK(); }
+
+  Status remove_callback_masked(uint32_t, uint32_t) override { return Status::OK(); }
+
+  Status open_can() override { return Status::OK(); }
+
+  Status close_can() override { return Status::OK(); }
+
+  bool supports_fd() const override { return _is_fd; }
+
+  std::vector<CanFrame> sent;
+  std::function<Status(const CanFrame&)> on_send;
+  std::function<Result<CanFrame>(const CanFrame&, uint32_t, uint32_t)> on_request;
+
+ private:
+  bool _is_fd;
+};
+
+} // namespace mcan::test
+
+#define MCAN_CHECK(condition)                                                           \
+  mcan::test::check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)